@@ -0,0 +1,55 @@
+#include <iostream>
+#include <string>
+
+#include <rd_utils/foreign/CLI11.hh>
+#include <service/traces/reader.hh>
+#include <service/traces/binary.hh>
+
+using namespace cachecache;
+
+/**
+ * Converts csv traces into binary traces, that the generators replay without parsing
+ */
+int main (int argc, char ** argv) {
+    CLI::App app("Convert csv traces to the binary traces format");
+
+    std::string input, output;
+    app.add_option("-i,--input", input, "the csv traces")->required();
+    app.add_option("-o,--output", output, "the binary traces to create")->required();
+
+    try {
+        app.parse(argc, argv);
+    } catch (const CLI::ParseError &e) {
+        return app.exit(e);
+    }
+
+    TraceReader reader;
+    if (!reader.open(input, true)) {
+        std::cerr << "Could not open traces files at " << input << std::endl;
+        return -1;
+    }
+
+    BinaryTraceWriter writer;
+    if (!writer.open(output)) {
+        std::cerr << "Could not create " << output << std::endl;
+        return -1;
+    }
+
+    line current;
+    uint64_t nb_lines = 0;
+    while (reader.next(current)) {
+        if (!writer.push(current)) {
+            std::cerr << "Traces are not sorted by timestamp at line " << nb_lines << std::endl;
+            return -1;
+        }
+        nb_lines++;
+    }
+
+    if (!writer.close()) {
+        std::cerr << "Could not write " << output << std::endl;
+        return -1;
+    }
+
+    std::cout << "Converted " << nb_lines << " lines, ignored " << reader.getIgnoredLines() << std::endl;
+    return 0;
+}
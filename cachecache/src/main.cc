@@ -2,6 +2,7 @@
 
 #include <rd_utils/concurrency/_.hh>
 #include <string.h>
+#include <unistd.h>
 #include <service/supervisor/supervisor.hh>
 #include <service/cachecache.hh>
 
@@ -11,11 +12,12 @@
 #include "folly/logging/LogLevel.h"
 #include <iostream>
 
-/*void ctrlCHandler(int signum) {
-	LOG_DEBUG("Signal ", strsignal(signum), " received");
-	generator::exitSignal.emit();
-	exit(0);
-}*/
+// the caches are saved by the supervisor once it stops, a second signal exits right away
+void stopHandler(int) {
+    if (cachecache::Supervisor::requestStop()) {
+        _exit(-1);
+    }
+}
 
 using namespace cachecache;
 
@@ -24,9 +26,8 @@ FOLLY_INIT_LOGGING_CONFIG("INFO");
 int main (int argc, char ** argv) {
     //folly::init(&argc, &argv, true);
 
-    /*signal(SIGINT, &ctrlCHandler);
-    signal(SIGTERM, &ctrlCHandler);
-    signal(SIGKILL, &ctrlCHandler);*/
+    signal(SIGINT, &stopHandler);
+    signal(SIGTERM, &stopHandler);
     
  try {
     cachecache::Supervisor supervisor;
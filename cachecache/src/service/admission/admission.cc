@@ -0,0 +1,140 @@
+#include "admission.hh"
+#include <algorithm>
+#include <bit>
+
+using namespace cachecache;
+
+Admission::Admission() {}
+
+Admission::Admission(Admission&& other):
+    _counters(std::move(other._counters))
+    , _doorkeeper(std::move(other._doorkeeper))
+    , _mask(other._mask)
+    , _doorkeeper_mask(other._doorkeeper_mask)
+    , _sample_size(other._sample_size)
+    , _additions(other._additions.load())
+    , _threshold(other._threshold) {
+        other._mask = 0;
+        other._doorkeeper_mask = 0;
+        other._sample_size = 0;
+        other._additions = 0;
+        other._threshold = 0;
+}
+
+void Admission::operator=(Admission&& other) {
+    this->_counters = std::move(other._counters);
+    this->_doorkeeper = std::move(other._doorkeeper);
+    this->_mask = other._mask;
+    this->_doorkeeper_mask = other._doorkeeper_mask;
+    this->_sample_size = other._sample_size;
+    this->_additions = other._additions.load();
+    this->_threshold = other._threshold;
+
+    other._mask = 0;
+    other._doorkeeper_mask = 0;
+    other._sample_size = 0;
+    other._additions = 0;
+    other._threshold = 0;
+}
+
+void Admission::configure(uint64_t capacity, unsigned int threshold) {
+    uint64_t width = std::bit_ceil(std::max(capacity, (uint64_t) 64));
+    this->_mask = width - 1;
+    this->_counters = std::make_unique<std::atomic<uint8_t>[]>(DEPTH * width);
+
+    // 8 bits per tracked key in the doorkeeper
+    uint64_t doorkeeper_bits = width * 8;
+    this->_doorkeeper_mask = doorkeeper_bits - 1;
+    this->_doorkeeper = std::make_unique<std::atomic<uint64_t>[]>(doorkeeper_bits / 64);
+
+    this->_sample_size = 10 * capacity;
+    this->_threshold = threshold;
+    this->reset();
+}
+
+bool Admission::enabled() const {
+    return this->_threshold != 0;
+}
+
+void Admission::record(uint64_t hash) {
+    if (!this->inDoorkeeper(hash)) {
+        this->addDoorkeeper(hash);
+    } else {
+        // conservative update, only the smallest counters are incremented
+        uint8_t min = this->count(hash);
+        if (min < MAX_COUNT) {
+            for (unsigned int row = 0; row < DEPTH; row++) {
+                auto & counter = this->_counters[this->index(hash, row)];
+                if (counter.load(std::memory_order_relaxed) == min) {
+                    counter.store(min + 1, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    // only the thread reaching the sample size ages the sketch
+    if (this->_additions.fetch_add(1, std::memory_order_relaxed) + 1 == this->_sample_size) {
+        this->age();
+    }
+}
+
+unsigned int Admission::estimate(uint64_t hash) const {
+    return this->count(hash) + (this->inDoorkeeper(hash) ? 1 : 0);
+}
+
+bool Admission::admit(uint64_t hash) const {
+    return this->estimate(hash) >= this->_threshold;
+}
+
+void Admission::reset() {
+    if (!this->_counters) return;
+
+    for (uint64_t i = 0; i < DEPTH * (this->_mask + 1); i++) {
+        this->_counters[i].store(0, std::memory_order_relaxed);
+    }
+    for (uint64_t i = 0; i <= this->_doorkeeper_mask / 64; i++) {
+        this->_doorkeeper[i].store(0, std::memory_order_relaxed);
+    }
+    this->_additions = 0;
+}
+
+uint8_t Admission::count(uint64_t hash) const {
+    uint8_t min = MAX_COUNT;
+    for (unsigned int row = 0; row < DEPTH; row++) {
+        min = std::min(min, this->_counters[this->index(hash, row)].load(std::memory_order_relaxed));
+    }
+
+    return min;
+}
+
+uint64_t Admission::index(uint64_t hash, unsigned int row) const {
+    // double hashing, the second hash is forced odd to visit distinct slots
+    uint64_t h1 = hash;
+    uint64_t h2 = (hash * 0x9E3779B97F4A7C15ULL) | 1;
+    return row * (this->_mask + 1) + ((h1 + row * h2) & this->_mask);
+}
+
+bool Admission::inDoorkeeper(uint64_t hash) const {
+    uint64_t b1 = hash & this->_doorkeeper_mask;
+    uint64_t b2 = (hash >> 32 | hash << 32) & this->_doorkeeper_mask;
+    return (this->_doorkeeper[b1 / 64].load(std::memory_order_relaxed) >> (b1 % 64) & 1)
+        && (this->_doorkeeper[b2 / 64].load(std::memory_order_relaxed) >> (b2 % 64) & 1);
+}
+
+void Admission::addDoorkeeper(uint64_t hash) {
+    uint64_t b1 = hash & this->_doorkeeper_mask;
+    uint64_t b2 = (hash >> 32 | hash << 32) & this->_doorkeeper_mask;
+    this->_doorkeeper[b1 / 64].fetch_or((uint64_t) 1 << (b1 % 64), std::memory_order_relaxed);
+    this->_doorkeeper[b2 / 64].fetch_or((uint64_t) 1 << (b2 % 64), std::memory_order_relaxed);
+}
+
+void Admission::age() {
+    for (uint64_t i = 0; i < DEPTH * (this->_mask + 1); i++) {
+        this->_counters[i].store(this->_counters[i].load(std::memory_order_relaxed) >> 1, std::memory_order_relaxed);
+    }
+    for (uint64_t i = 0; i <= this->_doorkeeper_mask / 64; i++) {
+        this->_doorkeeper[i].store(0, std::memory_order_relaxed);
+    }
+
+    this->_additions.fetch_sub(this->_sample_size / 2, std::memory_order_relaxed);
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// TinyLFU admission based on (https://arxiv.org/abs/1512.00727)
+namespace cachecache {
+    /**
+     * Approximate frequency of the recently requested keys
+     * A doorkeeper bloom filter absorbs the keys seen only once, the others are counted in a count-min sketch
+     * Every sample_size recorded accesses the counters are halved so old frequencies fade away
+     * Safe to use from concurrent threads, a few increments can be lost under contention
+     */
+    class Admission {
+        public:
+            Admission();
+
+            Admission(const Admission&) = delete;
+            void operator=(const Admission&) = delete;
+
+            Admission(Admission&&);
+            void operator=(Admission&&);
+
+            /**
+             * @params:
+             *    - capacity: the number of distinct keys expected to be tracked
+             *    - threshold: the estimated frequency needed by a key to be admitted
+             */
+            void configure(uint64_t capacity, unsigned int threshold);
+
+            bool enabled() const;
+
+            void record(uint64_t hash);
+            unsigned int estimate(uint64_t hash) const;
+            bool admit(uint64_t hash) const;
+
+            void reset();
+
+        private:
+            static constexpr unsigned int DEPTH = 4;
+            static constexpr uint8_t MAX_COUNT = 15;
+
+            // DEPTH rows of counters, each row of size _mask + 1
+            std::unique_ptr<std::atomic<uint8_t>[]> _counters;
+            std::unique_ptr<std::atomic<uint64_t>[]> _doorkeeper;
+
+            uint64_t _mask = 0;
+            uint64_t _doorkeeper_mask = 0;
+            uint64_t _sample_size = 0;
+            std::atomic<uint64_t> _additions = 0;
+            unsigned int _threshold = 0;
+
+            uint8_t count(uint64_t hash) const;
+            uint64_t index(uint64_t hash, unsigned int row) const;
+
+            bool inDoorkeeper(uint64_t hash) const;
+            void addDoorkeeper(uint64_t hash);
+
+            void age();
+    };
+}
@@ -1,14 +1,20 @@
 #include "cachecache.hh"
 #include "folly/logging/xlog.h"
 #include "folly/logging/LogLevel.h"
+#include <atomic>
 #include <chrono>
 #include <cmath>
 #include <vector>
 #include <algorithm>
+#include <string_view>
+#include <span>
+#include <charconv>
+#include <ctime>
 #include "cachelib/allocator/memory/MemoryPool.h"
 #include "cachelib/allocator/LruTailAgeStrategy.h"
 #include "cachelib/common/Exceptions.h"
 #include "cachelib/allocator/memory/Slab.h"
+#include <service/state/state.hh>
 
 using namespace rd_utils::concurrency;
 using namespace std::chrono;
@@ -20,10 +26,51 @@ using MMConfig = typename Cache::MMConfig;
 using CacheKey = typename Cache::Key;
 using CacheHandle = typename Cache::WriteHandle;
 
+/*
+ * The memory of an item follows its variable size key, the header starts at the next multiple of its alignment
+ * cachelib allocations are aligned on 8 bytes, so the padding only depends on the size of the key
+ */
+static size_t headerPadding(uintptr_t memory) {
+    return (alignof(ItemHeader) - memory % alignof(ItemHeader)) % alignof(ItemHeader);
+}
+
+static size_t allocationSize(CacheKey key, size_t value) {
+    return headerPadding(Cache::Item::getRequiredSize(key, 0)) + sizeof(ItemHeader) + value;
+}
+
+static ItemHeader* itemHeader(const Cache::Item& item) {
+    auto memory = reinterpret_cast<uintptr_t>(item.getMemory());
+    return reinterpret_cast<ItemHeader*>(memory + headerPadding(memory));
+}
+
+static char* itemValue(const Cache::Item& item) {
+    return reinterpret_cast<char*>(itemHeader(item) + 1);
+}
+
+static size_t valueSize(const Cache::Item& item) {
+    return item.getSize() - (itemValue(item) - reinterpret_cast<const char*>(item.getMemory()));
+}
+
+static uint64_t exchangeLastRequest(ItemHeader* header, uint64_t now) {
+    return std::atomic_ref<uint64_t>(header->last_request).exchange(now, std::memory_order_relaxed);
+}
+
+/*
+ * The gets, version and the cleans read the header of an item without its key lock,
+ * while the expiry and cas are written under the lock and the last request by every hit
+ */
+static uint64_t loadHeader(uint64_t& field) {
+    return std::atomic_ref<uint64_t>(field).load(std::memory_order_relaxed);
+}
+
+static void storeHeader(uint64_t& field, uint64_t value) {
+    std::atomic_ref<uint64_t>(field).store(value, std::memory_order_relaxed);
+}
+
 Cachecache::Cachecache() {}
 
 Cachecache::~Cachecache() {
-    XLOG(INFO, "Nb requests:", this->_reqs_total,  ". Hit ratio: ", static_cast<float>(this->_hits) / static_cast<float>(this->_reqs) * 100);
+    XLOG(INFO, "Nb requests:", this->_reqs_total.load(),  ". Hit ratio: ", static_cast<float>(this->_hits.load()) / static_cast<float>(this->_reqs.load()) * 100);
     this->_gCache.reset();
 }
 
@@ -31,17 +78,34 @@ Cachecache::Cachecache(Cachecache && other):
     _name(std::move(other._name))
     , _gCache(std::move(other._gCache))
     , _defaultPool(std::move(other._defaultPool))
+    , _shared(other._shared)
+    , _persistent(other._persistent)
+    , _restored(other._restored)
+    , _nvmPath(std::move(other._nvmPath))
+    , _nvmSize(other._nvmSize)
     , _clock(std::move(other._clock))
-    , _percentiles(std::move(other._percentiles))
-    , _hits(other._hits)
-    , _reqs(other._reqs)
-    , _reqs_total(other._reqs_total)
-    , _target(other._target)
+    , _deltas(std::move(other._deltas))
+    , _quantiles(other._quantiles)
+    , _decay(other._decay)
+    , _decay_period(other._decay_period)
+    , _last_decay(other._last_decay)
+    , _admission(std::move(other._admission))
+    , _cachesize(other._cachesize)
+    , _mrc(std::move(other._mrc))
+    , _expiries(std::move(other._expiries))
+    , _next_cas(other._next_cas.load())
+    , _hits(std::move(other._hits))
+    , _hits_total(std::move(other._hits_total))
+    , _reqs(std::move(other._reqs))
+    , _reqs_total(std::move(other._reqs_total))
+    , _rejected(std::move(other._rejected))
+    , _nvm_hits(std::move(other._nvm_hits))
+    , _expired(std::move(other._expired))
+    , _delta_counts(std::move(other._delta_counts))
+    , _target(other._target.load())
     , _metrics(std::move(other._metrics))
+    , _metric_handles(other._metric_handles)
 {
-    other._hits = 0;
-    other._reqs = 0;
-    other._reqs_total = 0;
     other._target = 0;
 }
 
@@ -49,38 +113,75 @@ void Cachecache::operator=(Cachecache && other) {
     this->_name = std::move(other._name);
     this->_gCache = std::move(other._gCache);
     this->_defaultPool = std::move(other._defaultPool);
+    this->_shared = other._shared;
+    this->_persistent = other._persistent;
+    this->_restored = other._restored;
+    this->_nvmPath = std::move(other._nvmPath);
+    this->_nvmSize = other._nvmSize;
     this->_clock = std::move(other._clock);
-    this->_percentiles = std::move(other._percentiles);
-    this->_hits = other._hits;
-    other._hits = 0;
-    this->_reqs = other._reqs;
-    other._reqs = 0;
-    this->_reqs_total = other._reqs_total;
-    other._reqs_total = 0;
-    this->_target = other._target;
+    this->_deltas = std::move(other._deltas);
+    this->_quantiles = other._quantiles;
+    this->_decay = other._decay;
+    this->_decay_period = other._decay_period;
+    this->_last_decay = other._last_decay;
+    this->_admission = std::move(other._admission);
+    this->_cachesize = other._cachesize;
+    this->_mrc = std::move(other._mrc);
+    this->_expiries = std::move(other._expiries);
+    this->_next_cas = other._next_cas.load();
+    this->_hits = std::move(other._hits);
+    this->_hits_total = std::move(other._hits_total);
+    this->_reqs = std::move(other._reqs);
+    this->_reqs_total = std::move(other._reqs_total);
+    this->_rejected = std::move(other._rejected);
+    this->_nvm_hits = std::move(other._nvm_hits);
+    this->_expired = std::move(other._expired);
+    this->_delta_counts = std::move(other._delta_counts);
+    this->_target = other._target.load();
     this->_metrics = std::move(other._metrics);
+    this->_metric_handles = other._metric_handles;
 }
 
-void Cachecache::configure(const std::string& name, size_t cachesize, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics) {
-    this->_name = name;
-    this->_clock = clock;
-    this->_metrics = metrics;
-    this->_percentiles[0].setPercentile(p0);
-    this->_percentiles[1].setPercentile(p1);
-    this->_percentiles[2].setPercentile(p2);
+void Cachecache::configure(const std::string& name, size_t cachesize, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics, const std::string& persistence) {
+    this->init(name, cachesize, requested, p0, p1, p2, clock, metrics);
 
-    this->_requested = requested;
+    facebook::cachelib::util::Throttler::Config throttler;
+    throttler.workMs = Cachecache::REAPER_WORK_MS;
+    throttler.sleepMs = Cachecache::REAPER_SLEEP_MS;
 
     CacheConfig config;
     config
         .setCacheSize(cachesize)
         .setCacheName("Cachecache")
+        .enableItemReaperInBackground(std::chrono::milliseconds(REAPER_INTERVAL_MS), throttler)
         .setAccessConfig(
             {25 /* bucket power */, 10 /* lock power */}) // assuming caching 20
                                                             // million items
         .validate(); // will throw if bad config
 
-    this->_gCache = std::make_unique<Cache>(config);
+    if (this->_nvmSize != 0) {
+        Cache::NvmCacheConfig nvmConfig;
+        nvmConfig.navyConfig.setBlockSize(4096);
+        // a persistent tier keeps the content of its file across restarts
+        nvmConfig.navyConfig.setSimpleFile(this->_nvmPath, this->_nvmSize, persistence.empty());
+        nvmConfig.navyConfig.blockCache().setRegionSize(16 * 1024 * 1024);
+        config.enableNvmCache(nvmConfig);
+        XLOG(INFO, "Flash tier of ", this->_nvmSize, " bytes for ", name, " on ", this->_nvmPath);
+    }
+
+    if (!persistence.empty()) {
+        config.enableCachePersistence(persistence);
+        this->_persistent = true;
+        try {
+            this->_gCache = std::make_shared<Cache>(Cache::SharedMemAttach, config);
+            this->_restored = true;
+        } catch (const std::exception& e) {
+            XLOG(INFO, "Could not restore cache ", name, " from ", persistence, " : ", e.what());
+            this->_gCache = std::make_shared<Cache>(Cache::SharedMemNew, config);
+        }
+    } else {
+        this->_gCache = std::make_shared<Cache>(config);
+    }
     
     facebook::cachelib::LruTailAgeStrategy::Config cfg;
     cfg.slabProjectionLength = 0; // dont project or estimate tail age
@@ -94,6 +195,14 @@ void Cachecache::configure(const std::string& name, size_t cachesize, size_t req
     mmConfig.lruRefreshTime = 0;
     mmConfig.updateOnRead = true;
     mmConfig.updateOnWrite = true;
+    if (this->_restored) {
+        // the pools are saved with the cache
+        this->_defaultPool = this->_gCache->getPoolId("default");
+        size_t nb_items = this->rebuildExpiries();
+        XLOG(INFO, "Restored cache ", name, " with ", nb_items, " items");
+        return;
+    }
+
     this->_defaultPool = this->_gCache->addPool(
                 "default", 
                 this->_gCache->getCacheMemoryStats().ramCacheSize, {}, 
@@ -103,7 +212,141 @@ void Cachecache::configure(const std::string& name, size_t cachesize, size_t req
     //this->resize(requested);
 }
 
+void Cachecache::configure(const std::string& name, SharedAllocator* allocator, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics) {
+    this->init(name, allocator->size(), requested, p0, p1, p2, clock, metrics);
+
+    this->_shared = allocator;
+    this->_gCache = allocator->getCache();
+    this->_defaultPool = allocator->addPool(name, requested);
+    if (this->_defaultPool == facebook::cachelib::Slab::kInvalidPoolId) {
+        throw std::runtime_error("no memory left in the shared allocator for cache " + name);
+    }
+
+    // the allocator is the one that is persistent, the cache only rebuilds what it keeps aside
+    this->_restored = allocator->restored();
+    if (this->_restored) {
+        size_t nb_items = this->rebuildExpiries();
+        XLOG(INFO, "Restored cache ", name, " with ", nb_items, " items");
+    }
+}
+
+void Cachecache::init(const std::string& name, size_t cachesize, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics) {
+    this->_name = name;
+    this->_clock = clock;
+    this->_metrics = metrics;
+    this->_quantiles = {p0, p1, p2};
+
+    this->_requested = requested;
+    this->_cachesize = cachesize;
+
+    Labels labels = {{"client", name}};
+    for (unsigned int i = 0; i < DeltaHistogram::NB_BUCKETS; i++) {
+        this->_metric_handles.deltas[i] = metrics->registerMetric("delta", {{"client", name}, {"bucket", std::to_string(DeltaHistogram::lower(i))}});
+    }
+    this->_metric_handles.delta_sum = metrics->registerMetric("delta_sum", labels);
+    this->_metric_handles.hits = metrics->registerMetric("hits", labels);
+    this->_metric_handles.nb_reqs = metrics->registerMetric("nb_reqs", labels);
+    this->_metric_handles.nvm_hits = metrics->registerMetric("nvm_hits", labels);
+    this->_metric_handles.expired = metrics->registerMetric("expired", labels);
+    for (int i = 0; i < 3; i++) {
+        this->_metric_handles.percentiles[i] = metrics->registerMetric("percentile", {{"client", name}, {"percentage", std::to_string(this->_quantiles[i])}});
+    }
+    this->_metric_handles.cache_size = metrics->registerMetric("cache_size", labels);
+    this->_metric_handles.memory_usage = metrics->registerMetric("memory_usage", labels);
+    this->_metric_handles.eviction_target = metrics->registerMetric("eviction_target", labels);
+    this->_metric_handles.nb_evictions = metrics->registerMetric("nb_evictions", labels);
+    this->_metric_handles.time_eviction = metrics->registerMetric("time_eviction", labels);
+    this->_metric_handles.size_eviction = metrics->registerMetric("size_eviction", labels);
+    this->_metric_handles.percentage_evictions = metrics->registerMetric("percentage_evictions", labels);
+}
+
+size_t Cachecache::rebuildExpiries() {
+    size_t nb_items = 0;
+    for (const auto& id: this->_gCache->getPool(this->_defaultPool).getStats().classIds) {
+        auto& container = this->_gCache->getMMContainer(this->_defaultPool, id);
+        for (auto itr = container.getEvictionIterator(); itr; ++itr) {
+            auto header = itemHeader(*itr);
+            // the ttl only matters by being non zero, the restored items already have their expiry
+            if (header->expiry != 0) this->indexExpiry(itr->getKey(), 1, header->expiry);
+            nb_items++;
+        }
+    }
+
+    return nb_items;
+}
+
+void Cachecache::indexExpiry(CacheKey key, uint32_t ttl, uint64_t expiry) {
+    if (ttl != 0 && this->wallTTL(ttl) == 0) {
+        this->_expiries.insert(std::string_view(key.data(), key.size()), expiry);
+    }
+}
+
+int Cachecache::reap(uint64_t now) {
+    this->_clean_keys.clear();
+    this->_clean_offsets.clear();
+    this->_expiries.pop(now, REAP_BATCH_SIZE, this->_clean_keys, this->_clean_offsets);
+
+    int reaped = 0;
+    for (size_t i = 0; i < this->_clean_offsets.size(); i++) {
+        size_t begin = this->_clean_offsets[i];
+        size_t end = i + 1 < this->_clean_offsets.size() ? this->_clean_offsets[i + 1] : this->_clean_keys.size();
+        CacheKey key{this->_clean_keys.data() + begin, end - begin};
+        try {
+            // the key may have been removed, or rewritten with another expiry, since it was indexed
+            auto item = this->_gCache->peek(key);
+            if (item == nullptr) continue;
+
+            uint64_t expiry = loadHeader(itemHeader(*item)->expiry);
+            if (expiry == 0 || expiry > now) continue;
+
+            this->_gCache->remove(item);
+            this->_expired.add();
+            reaped++;
+        } catch (const std::exception& e) {
+            XLOG(ERR, "Could not reap key ", key, " - ", e.what());
+        }
+    }
+
+    return reaped;
+}
+
+void Cachecache::setDecay(double factor, uint64_t period) {
+    this->_decay = std::clamp(factor, 0.0, 1.0);
+    this->_decay_period = std::max(period, (uint64_t) 1);
+}
+
+void Cachecache::configureNvm(const std::string& path, size_t size) {
+    this->_nvmPath = path;
+    this->_nvmSize = size;
+}
+
+void Cachecache::configureMissRatioCurve(double rate) {
+    XLOG(INFO, "Miss ratio curve for ", this->_name, " sampling ", rate * 100, "% of the keys");
+    // the curve covers the flash tier, to value the hits it serves
+    this->_mrc.configure(rate, facebook::cachelib::Slab::kSize, this->_cachesize + this->_nvmSize);
+}
+
+std::vector<double> Cachecache::hitCurve(double decay) {
+    if (!this->_mrc.enabled()) return {};
+
+    auto res = this->_mrc.hits();
+    this->_mrc.decay(decay);
+    return res;
+}
+
+void Cachecache::configureAdmission(uint64_t capacity, unsigned int threshold) {
+    XLOG(INFO, "Admission for ", this->_name, " tracking ", capacity, " keys with threshold ", threshold);
+    this->_admission.configure(capacity, threshold);
+    this->_metric_handles.admission_rejected = this->_metrics->registerMetric("admission_rejected", {{"client", this->_name}});
+}
+
 bool Cachecache::resize(size_t newsize) {
+    // the memory of a shared pool is moved to the other pools, never advised away
+    if (this->_shared != nullptr) {
+        this->_shared->rebalance({{this->_name, newsize}});
+        return true;
+    }
+
     size_t current = this->_gCache->getPool(this->_defaultPool).getPoolSize();
     XLOG(INFO, "Ask to resize from ", current, " to ", newsize, ". Will resize to ", this->getLowerResizeTarget(newsize));
     newsize = this->getLowerResizeTarget(newsize);
@@ -179,11 +422,111 @@ size_t Cachecache::size() const {
     return this->_gCache->getPool(this->_defaultPool).getPoolSize();
 }
 
+size_t Cachecache::nvmSize() const {
+    return this->_nvmSize;
+}
+
 size_t Cachecache::requested() const {
     return this->_requested;
 }
 
-bool Cachecache::get(CacheKey key) { 
+uint64_t Cachecache::requests() const {
+    return this->_reqs_total.load();
+}
+
+const std::string& Cachecache::getName() const {
+    return this->_name;
+}
+
+bool Cachecache::restored() const {
+    return this->_restored;
+}
+
+void Cachecache::save(std::ostream& out) const {
+    this->_deltas.save(out);
+    state::write(out, this->_target.load());
+    state::write(out, this->_targetedPercentile.load());
+    state::write(out, this->_next_cas.load());
+}
+
+bool Cachecache::load(std::istream& in) {
+    double target;
+    unsigned int percentile;
+    uint64_t next_cas;
+    if (!this->_deltas.load(in) || !state::read(in, target) || !state::read(in, percentile) || !state::read(in, next_cas)) return false;
+
+    // the versions of the restored items must not be given again
+    this->_next_cas = next_cas;
+
+    this->_target = target;
+    this->setTargetedPercentile(percentile);
+    return true;
+}
+
+void Cachecache::shutDown() {
+    // a shared allocator is shut down once, by its owner
+    if (!this->_persistent || this->_shared != nullptr) return;
+
+    auto status = this->_gCache->shutDown();
+    if (status == facebook::cachelib::ShutDownStatus::kSuccess) {
+        XLOG(INFO, "Cache ", this->_name, " saved");
+    } else {
+        XLOG(ERR, "Cache ", this->_name, " could not be saved, it will start empty");
+    }
+}
+
+bool Cachecache::get(CacheKey key) {
+    return this->lookup(key, nullptr, nullptr, nullptr);
+}
+
+bool Cachecache::get(CacheKey key, std::string& value, uint32_t& flags) {
+    return this->lookup(key, &value, &flags, nullptr);
+}
+
+bool Cachecache::get(CacheKey key, std::string& value, uint32_t& flags, uint64_t& cas) {
+    return this->lookup(key, &value, &flags, &cas);
+}
+
+CacheKey Cachecache::scope(CacheKey key, std::string& buffer) const {
+    if (this->_shared == nullptr) return key;
+
+    buffer.clear();
+    buffer.push_back(static_cast<char>(this->_defaultPool));
+    buffer.append(key.data(), key.size());
+    return CacheKey{buffer.data(), buffer.size()};
+}
+
+std::span<const CacheKey> Cachecache::scope(std::span<const CacheKey> keys) const {
+    if (this->_shared == nullptr) return keys;
+
+    // reused by the batches of the calling thread
+    thread_local std::vector<std::string> buffers;
+    thread_local std::vector<CacheKey> scoped;
+    if (buffers.size() < keys.size()) buffers.resize(keys.size());
+    scoped.resize(keys.size());
+    for (size_t i = 0; i < keys.size(); i++) {
+        scoped[i] = this->scope(keys[i], buffers[i]);
+    }
+
+    return scoped;
+}
+
+uint64_t Cachecache::version(CacheKey key) {
+    std::string scoped;
+    key = this->scope(key, scoped);
+    try {
+        auto item = this->_gCache->peek(key);
+        if (item == nullptr) return 0;
+        return loadHeader(itemHeader(*item)->cas);
+    } catch (const std::exception& e) {
+        XLOG(ERR, "Could not find key ", key, " - ", e.what());
+        return 0;
+    }
+}
+
+bool Cachecache::lookup(CacheKey key, std::string* value, uint32_t* flags, uint64_t* cas) { 
+    std::string scoped;
+    key = this->scope(key, scoped);
     CacheHandle item;
 
     try {
@@ -192,77 +535,392 @@ bool Cachecache::get(CacheKey key) {
         XLOG(ERR, "Could not find key ", key, " - ", e.what());
     }
 
-    this->_reqs++;
-    this->_reqs_total++;
+    uint64_t now = this->_clock->time();
+    if (item != nullptr) this->expire(item, now);
+
+    // the key is hashed once for the sampling, the admission and the key lock
+    uint64_t h = this->_mrc.enabled() || this->_admission.enabled() || value != nullptr ? this->hash(key) : 0;
+
+    this->_reqs.add();
+    this->_reqs_total.add();
+    if (this->_mrc.enabled()) {
+        this->_mrc.record(h, item != nullptr ? item->getSize() + key.size() : 0);
+    }
+
     if(item == nullptr) {
-        // if not in key buffer, add it
-        if (std::find(std::begin(this->_key_buffer), std::end(this->_key_buffer), key) == std::end(this->_key_buffer)) {
-            this->_key_buffer[this->_key_buffer_index] = key;
-            this->_key_buffer_index = (this->_key_buffer_index + 1) % 10000;
+        if (this->_admission.enabled()) {
+            this->_admission.record(h);
         }
         return false;
     }
     
-    this->_hits++;
+    this->_hits.add();
+    this->_hits_total.add();
 
-    folly::StringPiece sp{reinterpret_cast<const char*>(item->getMemory()),
-                          item->getSize()};
+    // the header is updated in place, the value is never touched
+    // the exchange is atomic so concurrent hits on the same item each see a distinct previous request
+    uint64_t last = exchangeLastRequest(itemHeader(*item), now);
+    if (item.wentToNvm()) this->_nvm_hits.add();
 
-    ITEM i = from_string(sp.str()); 
-    std::string value = i.value;
-    unsigned int last = i.last_request;
-    this->_metrics->push("delta", {{"client", this->_name}}, std::to_string(this->_clock->delta(last)));
-    
-    if (this->_calibrating) {
-        for(auto& percentile: this->_percentiles) {    
-            percentile.addValue(this->_clock->delta(last));
+    uint64_t delta = Clock::elapsed(last, now);
+    this->_delta_counts.record(delta);
+    this->_deltas.record(delta);
+
+    if (value != nullptr) {
+        // the value can be written in place by the other operations
+        std::scoped_lock lock(this->keyLock(h));
+        auto header = itemHeader(*item);
+        *flags = header->flags;
+        if (cas != nullptr) *cas = header->cas;
+        this->readValue(item, *value);
+    }
+
+    return true;
+}
+
+void Cachecache::readValue(const CacheHandle& item, std::string& value) {
+    std::string_view base(itemValue(*item), valueSize(*item));
+    if (!item->hasChainedItem()) {
+        value.assign(base);
+        return;
+    }
+
+    // the chain starts with the last chunk added: the prepends are in order, the appends reversed
+    thread_local std::vector<std::string_view> appends;
+    appends.clear();
+    value.clear();
+    for (const auto& chunk: this->_gCache->viewAsChainedAllocs(item).getChain()) {
+        auto memory = reinterpret_cast<const char*>(chunk.getMemory());
+        std::string_view data(memory + 1, chunk.getSize() - 1);
+        if (memory[0] == CHUNK_PREPEND) value.append(data);
+        else appends.push_back(data);
+    }
+
+    value.append(base);
+    for (auto it = appends.rbegin(); it != appends.rend(); ++it) {
+        value.append(*it);
+    }
+}
+
+std::mutex& Cachecache::keyLock(CacheKey key) {
+    return this->keyLock(this->hash(key));
+}
+
+std::mutex& Cachecache::keyLock(uint64_t hash) {
+    return this->_key_locks[hash % NB_KEY_LOCKS];
+}
+
+void Cachecache::touch(CacheHandle& item, uint64_t now) {
+    exchangeLastRequest(itemHeader(*item), now);
+}
+
+bool Cachecache::update(CacheHandle& item, CacheKey key, std::string_view value, uint32_t flags, uint32_t ttl, uint64_t now) {
+    if (item->hasChainedItem() || valueSize(*item) != value.size()) {
+        item.reset();
+        uint64_t rejected = 0;
+        return this->store(key, this->hash(key), value, flags, ttl, true, now, rejected);
+    }
+
+    auto header = itemHeader(*item);
+    std::memcpy(itemValue(*item), value.data(), value.size());
+    header->flags = flags;
+    uint64_t expiry = ttl != 0 ? now + Clock::fromSeconds(ttl) : 0;
+    storeHeader(header->expiry, expiry);
+    storeHeader(header->cas, this->_next_cas.fetch_add(1, std::memory_order_relaxed));
+    if (this->wallTTL(ttl) != 0) item->extendTTL(std::chrono::seconds(ttl));
+    else item->updateExpiryTime(0);
+    this->indexExpiry(key, ttl, expiry);
+
+    this->touch(item, now);
+    return true;
+}
+
+bool Cachecache::replace(CacheKey key, std::string_view value, uint32_t flags, uint32_t ttl) {
+    std::string scoped;
+    key = this->scope(key, scoped);
+    std::scoped_lock lock(this->keyLock(key));
+    uint64_t now = this->_clock->time();
+    try {
+        auto item = this->_gCache->findToWrite(key);
+        if (item == nullptr || this->expire(item, now)) return false;
+        return this->update(item, key, value, flags, ttl, now);
+    } catch (const std::exception& e) {
+        XLOG(ERR, "Could not replace key ", key, " - ", e.what());
+        return false;
+    }
+}
+
+STORE_RESULT Cachecache::cas(CacheKey key, std::string_view value, uint32_t flags, uint32_t ttl, uint64_t cas) {
+    std::string scoped;
+    key = this->scope(key, scoped);
+    std::scoped_lock lock(this->keyLock(key));
+    uint64_t now = this->_clock->time();
+    try {
+        auto item = this->_gCache->findToWrite(key);
+        if (item == nullptr || this->expire(item, now)) return STORE_RESULT::NOT_FOUND;
+        if (itemHeader(*item)->cas != cas) return STORE_RESULT::EXISTS;
+        return this->update(item, key, value, flags, ttl, now) ? STORE_RESULT::STORED : STORE_RESULT::NOT_STORED;
+    } catch (const std::exception& e) {
+        XLOG(ERR, "Could not cas key ", key, " - ", e.what());
+        return STORE_RESULT::NOT_STORED;
+    }
+}
+
+STORE_RESULT Cachecache::append(CacheKey key, std::string_view data) {
+    return this->chain(key, data, CHUNK_APPEND);
+}
+
+STORE_RESULT Cachecache::prepend(CacheKey key, std::string_view data) {
+    return this->chain(key, data, CHUNK_PREPEND);
+}
+
+STORE_RESULT Cachecache::chain(CacheKey key, std::string_view data, uint8_t kind) {
+    if (data.size() > MAX_VALUE_SIZE) return STORE_RESULT::TOO_LARGE;
+
+    std::string scoped;
+    key = this->scope(key, scoped);
+    std::scoped_lock lock(this->keyLock(key));
+    uint64_t now = this->_clock->time();
+    try {
+        auto item = this->_gCache->findToWrite(key);
+        if (item == nullptr || this->expire(item, now)) return STORE_RESULT::NOT_FOUND;
+
+        // the size of the whole value, read back by the gets, is checked before anything is allocated
+        size_t size = valueSize(*item) + data.size();
+        if (item->hasChainedItem()) {
+            for (const auto& chunk: this->_gCache->viewAsChainedAllocs(item).getChain()) {
+                size += chunk.getSize() - 1;
+            }
         }
-    } 
+        if (size > MAX_VALUE_SIZE) return STORE_RESULT::TOO_LARGE;
 
-    i.last_request = this->_clock->time();
-    //XLOG(INFO, "Last request (GET) ", last, " -> ", i.last_request);
+        auto chunk = this->_gCache->allocateChainedItem(item, 1 + data.size());
+        if (!chunk) {
+            XLOG(ERR, "Could not allocate.");
+            return STORE_RESULT::NOT_STORED;
+        }
 
-    std::string stritem = to_string(i);
+        auto memory = reinterpret_cast<char*>(chunk->getMemory());
+        memory[0] = kind;
+        std::memcpy(memory + 1, data.data(), data.size());
+        this->_gCache->addChainedItem(item, std::move(chunk));
 
-    if (item->getSize() >= stritem.size()) {
-        std::memcpy(item->getMemory(), stritem.c_str(), stritem.size());
-        return true;
+        storeHeader(itemHeader(*item)->cas, this->_next_cas.fetch_add(1, std::memory_order_relaxed));
+        this->touch(item, now);
+        return STORE_RESULT::STORED;
+    } catch (const std::exception& e) {
+        XLOG(ERR, "Could not chain data to key ", key, " - ", e.what());
+        return STORE_RESULT::NOT_STORED;
     }
+}
 
+STORE_RESULT Cachecache::incr(CacheKey key, uint64_t delta, uint64_t& value) {
+    return this->arithmetic(key, delta, true, value);
+}
+
+STORE_RESULT Cachecache::decr(CacheKey key, uint64_t delta, uint64_t& value) {
+    return this->arithmetic(key, delta, false, value);
+}
+
+STORE_RESULT Cachecache::arithmetic(CacheKey key, uint64_t delta, bool increment, uint64_t& value) {
+    std::string scoped;
+    key = this->scope(key, scoped);
+    thread_local std::string current;
+
+    uint64_t h = this->hash(key);
+    std::scoped_lock lock(this->keyLock(h));
+    uint64_t now = this->_clock->time();
     try {
-        auto handle = this->_gCache->allocate(this->_defaultPool, key, stritem.size());
-        std::memcpy(handle->getMemory(), stritem.c_str(), stritem.size());
-        this->_gCache->insertOrReplace(handle);
+        auto item = this->_gCache->findToWrite(key);
+        if (item == nullptr || this->expire(item, now)) return STORE_RESULT::NOT_FOUND;
+
+        // the values shortened by a decr are padded with spaces, as in memcached
+        this->readValue(item, current);
+        size_t length = current.find_last_not_of(' ') + 1;
+        auto res = std::from_chars(current.data(), current.data() + length, value);
+        if (length == 0 || res.ec != std::errc() || res.ptr != current.data() + length) return STORE_RESULT::NON_NUMERIC;
+
+        if (increment) value += delta;
+        else value = delta > value ? 0 : value - delta;
+
+        char digits[24];
+        size_t size = std::to_chars(digits, digits + sizeof(digits), value).ptr - digits;
+        auto header = itemHeader(*item);
+        if (!item->hasChainedItem() && size <= current.size()) {
+            char* data = itemValue(*item);
+            std::memcpy(data, digits, size);
+            std::memset(data + size, ' ', current.size() - size);
+            storeHeader(header->cas, this->_next_cas.fetch_add(1, std::memory_order_relaxed));
+            this->touch(item, now);
+            return STORE_RESULT::STORED;
+        }
+
+        // the number does not fit anymore, the item keeps its flags and its remaining time to live
+        uint32_t flags = header->flags;
+        // the remaining ttl in seconds, rounded up so the item does not expire earlier
+        uint32_t ttl = header->expiry != 0 ? (Clock::elapsed(now, header->expiry) + Clock::TICKS_PER_SECOND - 1) / Clock::TICKS_PER_SECOND : 0;
+        item.reset();
+        uint64_t rejected = 0;
+        return this->store(key, h, std::string_view(digits, size), flags, ttl, true, now, rejected) ? STORE_RESULT::STORED : STORE_RESULT::NOT_STORED;
     } catch (const std::exception& e) {
-        XLOG(ERR, "Could not update item : ", e.what());
+        XLOG(ERR, "Could not change key ", key, " - ", e.what());
+        return STORE_RESULT::NOT_STORED;
+    }
+}
+
+void Cachecache::getMany(std::span<const CacheKey> keys, std::vector<uint8_t>& hits) {
+    keys = this->scope(keys);
+    // handles of the batch, reused between the batches of the calling thread
+    thread_local std::vector<CacheHandle> handles;
+
+    hits.assign(keys.size(), 0);
+    handles.resize(keys.size());
+
+    // all the lookups first, a lookup still reading the flash tier is waited for in the second loop
+    for (size_t i = 0; i < keys.size(); i++) {
+        try {
+            handles[i] = this->_gCache->findToWrite(keys[i]);
+        } catch (std::exception& e) {
+            XLOG(ERR, "Could not find key ", keys[i], " - ", e.what());
+        }
     }
+
+    uint64_t now = this->_clock->time();
+    uint64_t nb_hits = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        if (handles[i] != nullptr) this->expire(handles[i], now);
+
+        uint64_t h = this->_mrc.enabled() || this->_admission.enabled() ? this->hash(keys[i]) : 0;
+        if (this->_mrc.enabled()) {
+            this->_mrc.record(h, handles[i] != nullptr ? handles[i]->getSize() + keys[i].size() : 0);
+        }
+
+        if (handles[i] == nullptr) {
+            if (this->_admission.enabled()) {
+                this->_admission.record(h);
+            }
+            continue;
+        }
+
+        uint64_t last = exchangeLastRequest(itemHeader(*handles[i]), now);
+        if (handles[i].wentToNvm()) this->_nvm_hits.add();
+
+        uint64_t delta = Clock::elapsed(last, now);
+        this->_deltas.record(delta);
+        this->_delta_counts.record(delta);
+
+        hits[i] = 1;
+        nb_hits++;
+        handles[i].reset();
+    }
+
+    this->_reqs.add(keys.size());
+    this->_reqs_total.add(keys.size());
+    this->_hits.add(nb_hits);
+    this->_hits_total.add(nb_hits);
+}
+
+uint32_t Cachecache::wallTTL(uint32_t ttl) const {
+    // cachelib expires the items in real time (reaper, finds), a virtual clock can be slower or faster than it
+    return this->_clock->source() == CLOCK_SOURCE::REALTIME ? ttl : 0;
+}
+
+bool Cachecache::expire(CacheHandle& item, uint64_t now) {
+    auto expiry = loadHeader(itemHeader(*item)->expiry);
+    if (expiry == 0 || expiry > now) return false;
+
+    try {
+        this->_gCache->remove(item);
+    } catch (const std::exception& e) {
+        XLOG(ERR, "Could not remove expired key ", item->getKey(), " - ", e.what());
+    }
+
+    item.reset();
+    this->_expired.add();
     return true;
 }
 
-bool Cachecache::put(CacheKey key, const std::string& value) {
-    ITEM item;
-    item.value = value;
-    item.last_request = this->_clock->time();
-    //XLOG(INFO, "Last request (PUT)", item.last_request);
-    std::string stritem = to_string(item); 
+bool Cachecache::put(CacheKey key, std::string_view value, uint32_t flags, uint32_t ttl) {
+    std::string scoped;
+    key = this->scope(key, scoped);
+    uint64_t h = this->hash(key);
+    std::scoped_lock lock(this->keyLock(h));
+    uint64_t rejected = 0;
+    bool stored = this->store(key, h, value, flags, ttl, true, this->_clock->time(), rejected);
+    if (rejected != 0) this->_rejected.add(rejected);
+
+    return stored;
+}
+
+bool Cachecache::add(CacheKey key, std::string_view value, uint32_t flags, uint32_t ttl) {
+    std::string scoped;
+    key = this->scope(key, scoped);
+    uint64_t h = this->hash(key);
+    std::scoped_lock lock(this->keyLock(h));
+    uint64_t rejected = 0;
+    bool stored = this->store(key, h, value, flags, ttl, false, this->_clock->time(), rejected);
+    if (rejected != 0) this->_rejected.add(rejected);
+
+    return stored;
+}
+
+bool Cachecache::remove(CacheKey key) {
+    std::string scoped;
+    key = this->scope(key, scoped);
+    try {
+        return this->_gCache->remove(key) == facebook::cachelib::RemoveRes::kSuccess;
+    } catch (const std::exception& e) {
+        XLOG(ERR, "Could not remove key ", key, " - ", e.what());
+        return false;
+    }
+}
+
+void Cachecache::putMany(std::span<const CacheKey> keys, std::span<const std::string_view> values, std::vector<uint8_t>& stored, std::span<const uint32_t> ttls) {
+    keys = this->scope(keys);
+    stored.assign(keys.size(), 0);
 
+    uint64_t now = this->_clock->time();
+    uint64_t rejected = 0;
+    for (size_t i = 0; i < keys.size(); i++) {
+        uint64_t h = this->hash(keys[i]);
+        std::scoped_lock lock(this->keyLock(h));
+        stored[i] = this->store(keys[i], h, values[i], 0, ttls.empty() ? 0 : ttls[i], true, now, rejected);
+    }
+
+    if (rejected != 0) this->_rejected.add(rejected);
+}
+
+bool Cachecache::store(CacheKey key, uint64_t hash, std::string_view value, uint32_t flags, uint32_t ttl, bool replace, uint64_t now, uint64_t& rejected) {
     try {
-        // if not present in cache nor in key buffer, put it in key buffer
-        /*if (this->_gCache->findFast(key) == nullptr && std::find(std::begin(this->_key_buffer), std::end(this->_key_buffer), key) == std::end(this->_key_buffer)) {
-            this->_key_buffer[this->_key_buffer_index] = key;
-            this->_key_buffer_index = (this->_key_buffer_index + 1) % 10000;
-            return true;
-        }*/
-
-        auto handle = this->_gCache->allocate(this->_defaultPool, key, stritem.size());
+        // keys not requested frequently enough are not worth the memory, unless they are updated
+        if (this->_admission.enabled()) {
+            if (!this->_admission.admit(hash) && this->_gCache->peek(key) == nullptr) {
+                this->_admission.record(hash);
+                rejected++;
+                return false;
+            }
+        }
+
+        auto handle = this->_gCache->allocate(this->_defaultPool, key, allocationSize(key, value.size()), this->wallTTL(ttl));
         
         if (!handle) {
             XLOG(ERR, "Could not allocate.");
             return false; // cache may fail to evict due to too many pending writes
         }
 
-        std::memcpy(handle->getMemory(), stritem.c_str(), stritem.size());
-        this->_gCache->insertOrReplace(handle);
+        auto header = itemHeader(*handle);
+        header->last_request = now;
+        header->flags = flags;
+        header->expiry = ttl != 0 ? now + Clock::fromSeconds(ttl) : 0;
+        header->cas = this->_next_cas.fetch_add(1, std::memory_order_relaxed);
+        std::memcpy(itemValue(*handle), value.data(), value.size());
+        if (replace) {
+            this->_gCache->insertOrReplace(handle);
+        } else if (!this->_gCache->insert(handle)) {
+            // the key is already in the cache
+            return false;
+        }
+        this->indexExpiry(key, ttl, header->expiry);
     } catch (const std::exception& e) {
         XLOG(ERR, "Key ", key);
         XLOG(ERR, "Could not allocate : ", e.what());
@@ -276,25 +934,33 @@ int Cachecache::clean(Thread t) {
 }
 
 int Cachecache::clean() {
-    XLOG(INFO, "Clean at time ", this->_clock->time());
-    /*for(const auto& percentile: this->_percentiles) {
-        XLOG(INFO,"Percentile: ", percentile.getIndex(), " = ", percentile.getEstimation(), " (count = ", percentile.getCount(), ")");
-    }*/
+    std::scoped_lock clean_lock(this->_clean_mutex);
+    XLOG(DBG, "Clean at time ", this->_clock->time());
+    std::array<double, 3> estimations;
     for(int i = 0; i < 3; i++) {
-        const auto& percentile = this->_percentiles[i];
-        XLOG(INFO,"Percentile: ", percentile.getIndex(), " = ", percentile.getEstimation(), " (count = ", percentile.getCount(), ")");
+        estimations[i] = this->_deltas.quantile(this->_quantiles[i]);
+        XLOG(DBG,"Percentile: ", this->_quantiles[i], " = ", estimations[i], " (count = ", this->_deltas.count(), ")");
     }
 
+    // older deltas weigh less in the next estimations, by the time elapsed and not by the number of cleans
+    uint64_t time = this->_clock->time();
+    if (this->_last_decay != UINT64_MAX) {
+        double periods = (double) Clock::elapsed(this->_last_decay, time) / (double) this->_decay_period;
+        this->_deltas.decay(std::pow(this->_decay, periods));
+    }
+    this->_last_decay = time;
+
+    // the expired items are reaped whatever the memory usage, cachelib does not reap them with a virtual clock
+    int nb_keys_reaped = this->reap(time);
+    XLOG(DBG, "Reaped ", nb_keys_reaped, " expired keys, ", this->_expiries.size(), " keys left in the expiry index");
+
     double perc_mem_usage = (double) this->currentMemoryUsage() / (double) this->requested();
-    XLOG(INFO, "Percentage memory usage ", perc_mem_usage * 100); 
+    XLOG(DBG, "Percentage memory usage ", perc_mem_usage * 100); 
 
     if (perc_mem_usage <= 0.5) {
-        this->_calibrating = true;
-        return 0;
+        return nb_keys_reaped;
     }
 
-    this->_calibrating = false;
-
     if (perc_mem_usage <= 0.8) this->_targetedPercentile = 2;
     if (perc_mem_usage <= 0.9) { 
         this->_targetedPercentile = 1;
@@ -302,7 +968,7 @@ int Cachecache::clean() {
         this->_targetedPercentile = 0;
     }
 
-    XLOG(INFO, "Targeted percentile ", this->_targetedPercentile); 
+    XLOG(DBG, "Targeted percentile ", this->_targetedPercentile.load()); 
     
     size_t before = 0;
 
@@ -310,38 +976,70 @@ int Cachecache::clean() {
         before = this->_gCache->getPool(this->_defaultPool).getCurrentAllocSize();
     } catch (const std::exception& e) {
         XLOG(ERR, "Could not get current alloc size for cache : ", e.what());
-        return 0;
+        return nb_keys_reaped;
     }
     int nb_keys_removed = 0;
     int nb_keys_used_removed = 0;
 
-    this->_target = this->_percentiles[this->_targetedPercentile].getEstimation() * 1.1;
+    double target = estimations[this->_targetedPercentile] * 1.1;
+    this->_target = target;
     
-    XLOG(INFO, "Target ", this->_target);
-    this->_metrics->push("eviction_target", {{"client", this->_name}}, std::to_string(this->_target));
+    XLOG(DBG, "Target ", target);
+    this->_metrics->push(this->_metric_handles.eviction_target, target);
 
     auto start = high_resolution_clock::now();
-    
+
+    uint64_t now = this->_clock->time();
+
     try {
-        for(const auto& id: this->_gCache->getPool(this->_defaultPool).getStats().classIds) {
-            auto& container = this->_gCache->getMMContainer(this->_defaultPool, id);
-            
-            std::vector<facebook::cachelib::KAllocation::Key> to_remove;
-            for(auto itr = container.getEvictionIterator(); itr; ++itr) {
-                folly::StringPiece sp{reinterpret_cast<const char*>(itr->getMemory()),
-                              itr->getSize()};
-
-                ITEM item = from_string(sp.str());
-                if(this->_clock->delta(item.last_request) <= this->_target) break;
-                if(item.last_request != 0) {
-                    nb_keys_used_removed++;
-                }
+        // with a flash tier the old items are left to the evictions of cachelib, which write them to flash
+        // (allocations and slab releases of the resizes), a remove would drop them from both tiers
+        // the scan of a class stops at its first item younger than the target
+        if (this->_nvmSize == 0) {
+            for(const auto& id: this->_gCache->getPool(this->_defaultPool).getStats().classIds) {
+                bool reached_target = false;
+                while (!reached_target) {
+                    // the keys are copied as the items can be freed once the container lock is released
+                    this->_clean_keys.clear();
+                    this->_clean_offsets.clear();
+                    {
+                        auto& container = this->_gCache->getMMContainer(this->_defaultPool, id);
+                        for(auto itr = container.getEvictionIterator(); itr && this->_clean_offsets.size() < CLEAN_BATCH_SIZE; ++itr) {
+                            auto header = itemHeader(*itr);
+                            // the expired items are removed along with the items older than the target
+                            uint64_t expiry = loadHeader(header->expiry);
+                            uint64_t last = loadHeader(header->last_request);
+                            bool expired = expiry != 0 && expiry <= now;
+                            if(!expired && this->_clock->delta(last) <= target) {
+                                reached_target = true;
+                                break;
+                            }
+                            if(last != 0) {
+                                nb_keys_used_removed++;
+                            }
+                            if (expired) {
+                                this->_expired.add();
+                            }
 
-                to_remove.push_back(itr->getKey());
-            }
-            for(auto key: to_remove) {
-                this->_gCache->remove(key);
-                nb_keys_removed++;
+                            auto key = itr->getKey();
+                            this->_clean_offsets.push_back(this->_clean_keys.size());
+                            this->_clean_keys.append(key.data(), key.size());
+                        }
+                    }
+
+                    int removed_in_batch = 0;
+                    for (size_t i = 0; i < this->_clean_offsets.size(); i++) {
+                        size_t begin = this->_clean_offsets[i];
+                        size_t end = i + 1 < this->_clean_offsets.size() ? this->_clean_offsets[i + 1] : this->_clean_keys.size();
+                        CacheKey key{this->_clean_keys.data() + begin, end - begin};
+                        if (this->_gCache->remove(key) == facebook::cachelib::RemoveRes::kSuccess) {
+                            removed_in_batch++;
+                        }
+                    }
+
+                    nb_keys_removed += removed_in_batch;
+                    if (removed_in_batch == 0) break;
+                }
             }
         }
     } catch (const std::exception& e) {
@@ -351,38 +1049,74 @@ int Cachecache::clean() {
     auto stop = high_resolution_clock::now();
     auto duration = duration_cast<milliseconds>(stop - start).count();
   
-    this->_metrics->push("nb_evictions", {{"client", this->_name}}, std::to_string(nb_keys_removed));
-    this->_metrics->push("time_eviction", {{"client", this->_name}}, std::to_string(duration));
+    this->_metrics->push(this->_metric_handles.nb_evictions, nb_keys_removed);
+    this->_metrics->push(this->_metric_handles.time_eviction, duration);
 
     size_t cachesize = this->_gCache->getPool(this->_defaultPool).getCurrentAllocSize();
-    this->_metrics->push("size_eviction", {{"client", this->_name}}, std::to_string(before - cachesize));
-    this->_metrics->push("percentage_evictions", {{"client", this->_name}}, std::to_string((before - cachesize) * 100 / before));
+    this->_metrics->push(this->_metric_handles.size_eviction, before - cachesize);
+    this->_metrics->push(this->_metric_handles.percentage_evictions, (before - cachesize) * 100 / before);
     try {
-        XLOG(INFO, "Removed ", nb_keys_removed, " keys in ", duration, ". Went from ", before, " to ", cachesize);
+        XLOG(DBG, "Removed ", nb_keys_removed, " keys in ", duration, ". Went from ", before, " to ", cachesize);
     } catch (const std::exception& e) {
         XLOG(ERR, "Could not get cache size : ", e.what());
     } 
 
-    return nb_keys_removed;
+    return nb_keys_removed + nb_keys_reaped;
 }
 
 void Cachecache::push_metrics() {
-    this->_metrics->push("hits", {{"client", this->_name}}, std::to_string(this->_hits));
-    this->_metrics->push("nb_reqs", {{"client", this->_name}}, std::to_string(this->_reqs));
+    this->_metrics->push(this->_metric_handles.hits, this->_hits.exchange());
+    this->_metrics->push(this->_metric_handles.nb_reqs, this->_reqs.exchange());
+
+    if (this->_admission.enabled()) {
+        this->_metrics->push(this->_metric_handles.admission_rejected, this->_rejected.exchange());
+    }
 
-    this->_hits = 0;
-    this->_reqs = 0;
+    this->_metrics->push(this->_metric_handles.expired, this->_expired.exchange());
+
+    if (this->_nvmSize != 0) {
+        this->_metrics->push(this->_metric_handles.nvm_hits, this->_nvm_hits.exchange());
+    }
 
     for (int i = 0; i < 3; i++) {
-        this->_metrics->push(
-                "percentile", 
-                {{"client", this->_name}, {"percentage", std::to_string(this->_percentiles[i].getPercentile())}},
-                std::to_string(this->_percentiles[i].getEstimation())
-        );
+        this->_metrics->push(this->_metric_handles.percentiles[i], this->_deltas.quantile(this->_quantiles[i]));
+    }
+
+    // the non empty buckets of the reuse deltas of the interval, with a single timestamp
+    auto deltas = this->_delta_counts.exchange();
+    std::array<Metrics::Handle, DeltaHistogram::NB_BUCKETS + 1> handles;
+    std::array<double, DeltaHistogram::NB_BUCKETS + 1> values;
+    size_t nb = 0;
+    for (unsigned int i = 0; i < DeltaHistogram::NB_BUCKETS; i++) {
+        if (deltas.counts[i] == 0) continue;
+        handles[nb] = this->_metric_handles.deltas[i];
+        values[nb] = deltas.counts[i];
+        nb++;
+    }
+
+    if (nb != 0) {
+        handles[nb] = this->_metric_handles.delta_sum;
+        values[nb] = deltas.sum;
+        this->_metrics->push(std::span<const Metrics::Handle>(handles.data(), nb + 1), std::span<const double>(values.data(), nb + 1));
     }
   
-    this->_metrics->push("cache_size", {{"client", this->_name}}, std::to_string(this->size()));
-    this->_metrics->push("memory_usage", {{"client", this->_name}}, std::to_string(this->currentMemoryUsage()));
+    this->_metrics->push(this->_metric_handles.cache_size, this->size());
+    this->_metrics->push(this->_metric_handles.memory_usage, this->currentMemoryUsage());
+}
+
+CacheStats Cachecache::stats() const {
+    CacheStats stats;
+    stats.hits = this->_hits_total.load();
+    stats.requests = this->_reqs_total.load();
+    stats.cache_size = this->size();
+    stats.memory_usage = this->currentMemoryUsage();
+    stats.eviction_target = this->_target.load();
+    for (int i = 0; i < 3; i++) {
+        stats.quantiles[i] = this->_quantiles[i];
+        stats.deltas[i] = this->_deltas.quantile(this->_quantiles[i]);
+    }
+
+    return stats;
 }
 
 size_t Cachecache::currentMemoryUsage() const {
@@ -390,19 +1124,10 @@ size_t Cachecache::currentMemoryUsage() const {
     return this->_gCache->getPool(this->_defaultPool).getCurrentAllocSize();
 }
 
-void Cachecache::setTargetedPercentile(unsigned int i) {
-    this->_targetedPercentile = std::min(i, (unsigned int)this->_percentiles.size());
-}
-
-ITEM Cachecache::from_string(std::string s) const {
-    auto delimiter = s.find(":");
-    
-    ITEM i;
-    i.last_request = this->_clock->from_string(s.substr(0, delimiter));
-    i.value = s.substr(delimiter + 1);
-    return i;
+uint64_t Cachecache::hash(CacheKey key) const {
+    return std::hash<std::string_view>{}(std::string_view(key.data(), key.size()));
 }
 
-std::string Cachecache::to_string(ITEM i) const {
-    return this->_clock->to_string(i.last_request) + ":" + i.value;
+void Cachecache::setTargetedPercentile(unsigned int i) {
+    this->_targetedPercentile = std::min(i, (unsigned int)this->_quantiles.size());
 }
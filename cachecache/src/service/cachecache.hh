@@ -2,9 +2,16 @@
 
 #include <array>
 #include <chrono>
+#include <istream>
+#include <ostream>
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <vector>
 
 #include "cachelib/allocator/CacheAllocator.h"
 #include <rd_utils/concurrency/thread.hh>
@@ -12,16 +19,70 @@
 
 #include <service/metrics/metrics.hh>
 #include <service/clock/clock.hh>
-#include <service/percentile.hh>
+#include <service/sketch/sketch.hh>
+#include <service/admission/admission.hh>
+#include <service/expiry/expiry.hh>
+#include <service/counter/counter.hh>
+#include <service/delta/delta.hh>
+#include <service/mrc/mrc.hh>
+#include <service/shared/shared.hh>
 
 namespace cachecache {
-    struct ITEM {
-        std::string value;
-        unsigned int last_request;
+    /**
+     * Fixed size metadata written in front of the value of every item stored in cachelib
+     * The header starts at the first multiple of its alignment after the key, the raw value directly follows it
+     */
+    struct ItemHeader {
+        // time of the last get/put on the item, in ticks of the clock of the cache
+        uint64_t last_request;
+        // time of the clock after which the item is expired, 0 if it never expires
+        uint64_t expiry;
+        // version of the value, changed by every write (memcached cas unique)
+        uint64_t cas;
+        // opaque flags of the memcached clients
+        uint32_t flags;
     };
 
+    /**
+     * Outcome of the operations modifying an existing item
+     */
+    enum class STORE_RESULT {
+        STORED
+        ,NOT_STORED
+        ,EXISTS // the version of the item is not the expected one
+        ,NOT_FOUND
+        ,NON_NUMERIC // incr or decr of a value that is not a number
+        ,TOO_LARGE // the value would be larger than Cachecache::MAX_VALUE_SIZE
+    };
+
+    /**
+     * Live state of a cache, read without blocking the requests
+     */
+    struct CacheStats {
+        uint64_t hits;
+        uint64_t requests;
+        size_t cache_size;
+        size_t memory_usage;
+        double eviction_target;
+        // the estimations of the quantiles of the reuse deltas
+        std::array<double, 3> quantiles;
+        std::array<double, 3> deltas;
+    };
+
+    /**
+     * A cache of a tenant
+     * get and put can be called from any number of threads, concurrently with clean, resize and push_metrics
+     */
     class Cachecache {
         public:
+            // the background reaper of the items whose cachelib ttl is over, at most REAPER_WORK_MS of work every REAPER_SLEEP_MS
+            static constexpr unsigned int REAPER_INTERVAL_MS = 1000;
+            static constexpr unsigned int REAPER_WORK_MS = 5;
+            static constexpr unsigned int REAPER_SLEEP_MS = 45;
+
+            // the largest value of an item, as the default item size limit of memcached
+            static constexpr size_t MAX_VALUE_SIZE = 1024 * 1024;
+
             Cachecache();
             ~Cachecache();
 
@@ -31,7 +92,58 @@ namespace cachecache {
             Cachecache(Cachecache &&);
             void operator=(Cachecache &&);
 
-            void configure(const std::string& name, size_t cachesize, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics);
+            /**
+             * @params:
+             *    - persistence: directory where cachelib saves the cache at shutdown, the cache is not persistent if empty
+             *                   the cache is restored from it if it was shut down cleanly
+             */
+            void configure(const std::string& name, size_t cachesize, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics, const std::string& persistence = "");
+
+            /**
+             * Configure the cache as a pool of an allocator shared with other caches
+             * The pool starts with the requested size, or what is left in the allocator
+             */
+            void configure(const std::string& name, SharedAllocator* allocator, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics);
+
+            /**
+             * Reject the puts of keys that were not requested at least threshold times recently
+             * Must be called after configure, the rejections are exported by the metrics of the cache
+             * @params:
+             *    - capacity: the number of distinct keys tracked by the frequency sketch
+             */
+            void configureAdmission(uint64_t capacity, unsigned int threshold);
+
+            /**
+             * Add a flash tier to the cache, the items evicted from memory by cachelib are demoted to it
+             * The cleans then only remove the expired items, the old ones are left to the evictions
+             * Must be called before configure, only with a cache that has its own allocator
+             * @params:
+             *    - path: the file or block device backing the tier
+             *    - size: the size of the tier in bytes
+             */
+            void configureNvm(const std::string& path, size_t size);
+
+            /**
+             * Set the factor applied to the weight of the recorded reuse deltas every period of the clock of the cache
+             * 1 keeps every delta since the start, lower values follow the recent workload
+             * The cleans apply it for the time elapsed since the previous one, whatever their frequency
+             * @params:
+             *    - period: in ticks of the clock
+             */
+            void setDecay(double factor, uint64_t period);
+
+            /**
+             * Estimate the hits the cache would get at every size, from the reuse distances of a sample of the keys
+             * @params:
+             *    - rate: the fraction of the keys sampled
+             */
+            void configureMissRatioCurve(double rate);
+
+            /**
+             * @returns: hits[i] is the estimated number of hits of the cache with i slabs, empty if the curve is not configured
+             * The weight of the past hits is decayed after each call
+             */
+            std::vector<double> hitCurve(double decay);
             bool resize(size_t newsize);
 
             size_t getUpperResizeTarget(size_t target) const;
@@ -39,47 +151,286 @@ namespace cachecache {
 
             
             bool get(facebook::cachelib::LruAllocator::Key key);
-            bool put(facebook::cachelib::LruAllocator::Key key, const std::string& value);
+
+            /**
+             * @params:
+             *    - ttl: the time to live of the item in seconds, 0 if it never expires
+             */
+            bool put(facebook::cachelib::LruAllocator::Key key, std::string_view value, uint32_t flags = 0, uint32_t ttl = 0);
+
+            /**
+             * Get a key and copy its value, accounted like get(key)
+             */
+            bool get(facebook::cachelib::LruAllocator::Key key, std::string& value, uint32_t& flags);
+
+            /**
+             * Get a key, its value and its version (memcached gets)
+             */
+            bool get(facebook::cachelib::LruAllocator::Key key, std::string& value, uint32_t& flags, uint64_t& cas);
+
+            /**
+             * @returns: the version of a key, 0 if it is not in the cache, not accounted as a request
+             */
+            uint64_t version(facebook::cachelib::LruAllocator::Key key);
+
+            /**
+             * Put a key only if it is not already in the cache
+             */
+            bool add(facebook::cachelib::LruAllocator::Key key, std::string_view value, uint32_t flags = 0, uint32_t ttl = 0);
+
+            bool remove(facebook::cachelib::LruAllocator::Key key);
+
+            /**
+             * Put a key only if it is already in the cache
+             * A value of the same size is written in place
+             */
+            bool replace(facebook::cachelib::LruAllocator::Key key, std::string_view value, uint32_t flags = 0, uint32_t ttl = 0);
+
+            /**
+             * Replace the value of a key only if its version is still cas
+             */
+            STORE_RESULT cas(facebook::cachelib::LruAllocator::Key key, std::string_view value, uint32_t flags, uint32_t ttl, uint64_t cas);
+
+            /**
+             * Add data after/before the value of a key in the cache, as a chained item, the value is not copied
+             * @returns: TOO_LARGE if the whole value would exceed MAX_VALUE_SIZE, nothing is added then
+             */
+            STORE_RESULT append(facebook::cachelib::LruAllocator::Key key, std::string_view data);
+            STORE_RESULT prepend(facebook::cachelib::LruAllocator::Key key, std::string_view data);
+
+            /**
+             * Add/subtract delta to the decimal value of a key, in place if the result fits
+             * incr wraps around 2^64, decr stops at 0
+             * @params:
+             *    - value: output, the new value
+             */
+            STORE_RESULT incr(facebook::cachelib::LruAllocator::Key key, uint64_t delta, uint64_t& value);
+            STORE_RESULT decr(facebook::cachelib::LruAllocator::Key key, uint64_t delta, uint64_t& value);
+
+            /**
+             * Get a batch of keys, with one update of the counters and metrics for the whole batch
+             * @params:
+             *    - hits: output buffer, hits[i] is set to 1 if keys[i] was found and 0 otherwise
+             */
+            void getMany(std::span<const facebook::cachelib::LruAllocator::Key> keys, std::vector<uint8_t>& hits);
+
+            /**
+             * Put a batch of keys, values[i] being the value of keys[i]
+             * @params:
+             *    - stored: output buffer, stored[i] is set to 1 if keys[i] was stored and 0 otherwise
+             *    - ttls: ttls[i] is the time to live of keys[i], no key expires if empty
+             */
+            void putMany(std::span<const facebook::cachelib::LruAllocator::Key> keys, std::span<const std::string_view> values, std::vector<uint8_t>& stored, std::span<const uint32_t> ttls = {});
 
             int clean(rd_utils::concurrency::Thread);
             int clean();
 
             void push_metrics();
 
+            CacheStats stats() const;
+
             size_t currentMemoryUsage() const;
             size_t requested() const;
+
+            /**
+             * @returns: the number of requests received since the start
+             */
+            uint64_t requests() const;
+            const std::string& getName() const;
             size_t size() const;
 
+            /**
+             * @returns: the size of the flash tier, 0 if the cache only uses memory
+             */
+            size_t nvmSize() const;
+
+            /**
+             * @returns: true if the items of the cache were restored from a previous run
+             */
+            bool restored() const;
+
+            /**
+             * Save the state that is not in cachelib (the estimation of the reuse deltas and the eviction target)
+             */
+            void save(std::ostream& out) const;
+
+            /**
+             * @returns: false if the saved state cannot be read
+             */
+            bool load(std::istream& in);
+
+            /**
+             * Save the cachelib allocator of a persistent cache, no request must be running
+             * The cache cannot be used afterwards
+             */
+            void shutDown();
+
             void setTargetedPercentile(unsigned int i);
 
         private:
+            friend SharedAllocator;
+
             std::string _name;
             size_t _requested;
 
-            std::unique_ptr<facebook::cachelib::LruAllocator> _gCache;
+            std::shared_ptr<facebook::cachelib::LruAllocator> _gCache;
             facebook::cachelib::PoolId _defaultPool;
+            // the allocator the pool belongs to, nullptr if the cache has its own allocator
+            SharedAllocator* _shared = nullptr;
+            bool _persistent = false;
+            bool _restored = false;
+
+            // flash tier, not used if the size is 0
+            std::string _nvmPath;
+            size_t _nvmSize = 0;
 
             Clock* _clock;
 
-            std::array<Percentile, 3> _percentiles;
-            std::array<facebook::cachelib::LruAllocator::Key, 10000> _key_buffer;
-            int _key_buffer_index = 0;
+            // reuse deltas of the hits
+            QuantileSketch _deltas;
+            // the quantiles of the deltas that can be used as eviction target
+            std::array<double, 3> _quantiles;
+            double _decay = 1;
+            uint64_t _decay_period = Clock::fromSeconds(3);
+            // time of the clock at the last decay of the reuse deltas, UINT64_MAX before the first clean
+            uint64_t _last_decay = UINT64_MAX;
 
-            unsigned int _targetedPercentile = 2;
+            Admission _admission;
+            // size of the whole cachelib allocator, the largest size of the miss ratio curve
+            size_t _cachesize = 0;
+            MissRatioCurve _mrc;
+            // keys by expiry time, of the items whose ttl is not given to cachelib (virtual clocks)
+            ExpiryIndex _expiries{Clock::TICKS_PER_SECOND};
+            // maximal number of expired keys reaped by a clean
+            static constexpr size_t REAP_BATCH_SIZE = 16384;
 
-            bool _calibrating = true;
+            // maximal number of keys removed per lock of an eviction container during a clean
+            static constexpr size_t CLEAN_BATCH_SIZE = 1024;
+            std::mutex _clean_mutex;
+            std::string _clean_keys;
+            std::vector<size_t> _clean_offsets;
+
+            std::atomic<unsigned int> _targetedPercentile = 2;
+
+            // the version given to the next write
+            std::atomic<uint64_t> _next_cas = 1;
+
+            // the writes of a key are serialized by one of these locks, as the reads copying values
+            static constexpr size_t NB_KEY_LOCKS = 1024;
+            std::array<std::mutex, NB_KEY_LOCKS> _key_locks;
+
+            // first byte of the chained items of a value
+            static constexpr uint8_t CHUNK_APPEND = 0;
+            static constexpr uint8_t CHUNK_PREPEND = 1;
 
             // METRICS
-            unsigned long _hits = 0;
-            unsigned long _reqs = 0;
-            unsigned long _reqs_total = 0;
-            double _target = 0;
+            ShardedCounter _hits;
+            ShardedCounter _hits_total;
+            ShardedCounter _reqs;
+            ShardedCounter _reqs_total;
+            ShardedCounter _rejected;
+            // hits on items that were read back from the flash tier
+            ShardedCounter _nvm_hits;
+            // items found expired by the gets and the cleans
+            ShardedCounter _expired;
+            // reuse deltas of the hits since the last push_metrics
+            DeltaHistogram _delta_counts;
+            std::atomic<double> _target = 0;
             
             Metrics* _metrics;
 
+            // the metrics of the cache, registered in configure
+            struct MetricHandles {
+                std::array<Metrics::Handle, DeltaHistogram::NB_BUCKETS> deltas;
+                Metrics::Handle delta_sum;
+                Metrics::Handle hits;
+                Metrics::Handle nb_reqs;
+                Metrics::Handle admission_rejected;
+                Metrics::Handle nvm_hits;
+                Metrics::Handle expired;
+                std::array<Metrics::Handle, 3> percentiles;
+                Metrics::Handle cache_size;
+                Metrics::Handle memory_usage;
+                Metrics::Handle eviction_target;
+                Metrics::Handle nb_evictions;
+                Metrics::Handle time_eviction;
+                Metrics::Handle size_eviction;
+                Metrics::Handle percentage_evictions;
+            } _metric_handles;
+
+            /**
+             * Register the metrics, common to both configurations
+             */
+            void init(const std::string& name, size_t cachesize, size_t requested, double p0, double p1, double p2, Clock* clock, Metrics* metrics);
+
+            /**
+             * Index the items of a restored cache expiring in the time of the cache
+             * @returns: the number of items of the cache
+             */
+            size_t rebuildExpiries();
+
+            /**
+             * Remove the items found expired by the expiry index, at most REAP_BATCH_SIZE
+             * @returns: the number of items removed
+             */
+            int reap(uint64_t now);
+
+            /**
+             * Index the expiry of an item if cachelib does not know it
+             */
+            void indexExpiry(facebook::cachelib::LruAllocator::Key key, uint32_t ttl, uint64_t expiry);
+
             void shrink(size_t amount);
 
-            std::string to_string(ITEM) const;
-            ITEM from_string(std::string) const;
+            bool lookup(facebook::cachelib::LruAllocator::Key key, std::string* value, uint32_t* flags, uint64_t* cas);
+            bool store(facebook::cachelib::LruAllocator::Key key, uint64_t hash, std::string_view value, uint32_t flags, uint32_t ttl, bool replace, uint64_t now, uint64_t& rejected);
+
+            /**
+             * Remove the item of a handle if it is expired, the handle is then reset
+             * @returns: true if the item was expired
+             */
+            bool expire(facebook::cachelib::LruAllocator::WriteHandle& item, uint64_t now);
+
+            /**
+             * @returns: the ttl given to cachelib, which expires the items in real time
+             * 0 with a virtual clock, the items then only expire in the time of the cache (header, cleans)
+             */
+            uint32_t wallTTL(uint32_t ttl) const;
+
+            std::mutex& keyLock(facebook::cachelib::LruAllocator::Key key);
+            std::mutex& keyLock(uint64_t hash);
+
+            /**
+             * Copy the value of an item, with its appended and prepended chunks
+             */
+            void readValue(const facebook::cachelib::LruAllocator::WriteHandle& item, std::string& value);
+
+            /**
+             * Replace the value of an existing item, in place if it has the same size, the key lock must be held
+             */
+            bool update(facebook::cachelib::LruAllocator::WriteHandle& item, facebook::cachelib::LruAllocator::Key key, std::string_view value, uint32_t flags, uint32_t ttl, uint64_t now);
+
+            /**
+             * Update the last request of an item written in place
+             */
+            void touch(facebook::cachelib::LruAllocator::WriteHandle& item, uint64_t now);
+
+            STORE_RESULT chain(facebook::cachelib::LruAllocator::Key key, std::string_view data, uint8_t kind);
+            STORE_RESULT arithmetic(facebook::cachelib::LruAllocator::Key key, uint64_t delta, bool increment, uint64_t& value);
+
+            /**
+             * @returns: the key of the item in the cachelib hash table
+             * The pools of a shared allocator share the table, the keys of a cache are then prefixed by the id of its pool
+             * @params:
+             *    - buffer: holds the prefixed key, must outlive the returned key
+             */
+            facebook::cachelib::LruAllocator::Key scope(facebook::cachelib::LruAllocator::Key key, std::string& buffer) const;
+
+            /**
+             * @returns: the keys of a batch in the cachelib hash table, valid until the next batch of the calling thread
+             */
+            std::span<const facebook::cachelib::LruAllocator::Key> scope(std::span<const facebook::cachelib::LruAllocator::Key> keys) const;
+
+            uint64_t hash(facebook::cachelib::LruAllocator::Key key) const;
     };
 }
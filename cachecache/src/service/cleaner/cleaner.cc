@@ -0,0 +1,155 @@
+#include "cleaner.hh"
+
+#include <algorithm>
+
+#include "folly/logging/xlog.h"
+#include "folly/logging/LogLevel.h"
+
+using namespace cachecache;
+using namespace rd_utils::concurrency;
+using namespace std::chrono;
+
+Cleaner::Cleaner() {}
+
+Cleaner::~Cleaner() {
+    this->stop();
+}
+
+void Cleaner::configure(size_t workers, milliseconds period) {
+    this->_nb_workers = std::max(workers, (size_t) 1);
+    this->_period = std::max(period, MIN_INTERVAL);
+}
+
+void Cleaner::addCache(const std::string& name, Cachecache* cache) {
+    Tenant tenant;
+    tenant.name = name;
+    tenant.cache = cache;
+    tenant.interval = this->_period;
+    this->_tenants.push_back(std::move(tenant));
+}
+
+void Cleaner::start(bool adaptive) {
+    this->_adaptive = adaptive;
+    this->_stop = false;
+
+    auto now = steady_clock::now();
+    if (adaptive) {
+        for (size_t i = 0; i < this->_tenants.size(); i++) {
+            this->_tenants[i].last = now;
+            this->_due.emplace(now + this->_tenants[i].interval, i);
+        }
+    }
+
+    for (size_t i = 0; i < this->_nb_workers; i++) {
+        this->_workers.push_back(spawn(this, &Cleaner::work));
+    }
+}
+
+void Cleaner::cleanAll() {
+    std::unique_lock lock(this->_mutex);
+    for (size_t i = 0; i < this->_tenants.size(); i++) {
+        this->_due.emplace(steady_clock::time_point::min(), i);
+    }
+    this->_pending += this->_tenants.size();
+    this->_cv.notify_all();
+
+    this->_done.wait(lock, [this] { return this->_pending == 0 || this->_stop; });
+}
+
+void Cleaner::stop() {
+    {
+        std::scoped_lock lock(this->_mutex);
+        this->_stop = true;
+    }
+    this->_cv.notify_all();
+    this->_done.notify_all();
+
+    for (auto & worker: this->_workers) {
+        join(worker);
+    }
+
+    this->_workers.clear();
+    this->_due = {};
+}
+
+void Cleaner::work(Thread) {
+    while (true) {
+        size_t index;
+        {
+            std::unique_lock lock(this->_mutex);
+            while (true) {
+                if (this->_stop) return;
+                if (this->_due.empty()) {
+                    this->_cv.wait(lock);
+                    continue;
+                }
+
+                auto due = this->_due.top().first;
+                if (due > steady_clock::now()) {
+                    this->_cv.wait_until(lock, due);
+                    continue;
+                }
+
+                index = this->_due.top().second;
+                this->_due.pop();
+                break;
+            }
+        }
+
+        auto & tenant = this->_tenants[index];
+        this->clean(tenant);
+
+        std::scoped_lock lock(this->_mutex);
+        if (!this->_adaptive) {
+            if (--this->_pending == 0) this->_done.notify_all();
+        } else {
+            // the next clean can be due before the ones the other workers are waiting for
+            this->_due.emplace(tenant.last + tenant.interval, index);
+            this->_cv.notify_one();
+        }
+    }
+}
+
+void Cleaner::clean(Tenant& tenant) {
+    auto start = steady_clock::now();
+    double elapsed = duration<double>(start - tenant.last).count();
+    uint64_t requests = tenant.cache->requests();
+    size_t usage = tenant.cache->currentMemoryUsage();
+    size_t requested = std::max(tenant.cache->requested(), (size_t) 1);
+
+    int removed = 0;
+    try {
+        removed = tenant.cache->clean();
+    } catch (const std::exception& e) {
+        XLOG(ERR, "Could not clean cache ", tenant.name, " : ", e.what());
+    }
+
+    double pressure = (double) usage / (double) requested;
+    double rate = elapsed > 0 ? (double) (requests - tenant.requests) / elapsed : 0;
+
+    milliseconds interval = tenant.interval;
+    if (rate == 0 || pressure <= 0.5) {
+        // nothing to reclaim until the cache fills up, a clean would return right away
+        interval = this->_period * BACKOFF;
+    } else {
+        // productive cleans come back sooner, fruitless ones back off
+        interval = removed > 0 ? interval / 2 : interval * 2;
+
+        // the fullest caches are cleaned at least every period
+        if (pressure >= 0.9) interval = std::min(interval, this->_period);
+
+        // the memory filled since the last clean tells when the cache will be full
+        if (elapsed > 0 && usage > tenant.usage && usage < requested) {
+            double growth = (double) (usage - tenant.usage) / elapsed;
+            auto full = duration_cast<milliseconds>(duration<double>((double) (requested - usage) / growth));
+            interval = std::min(interval, full / 2);
+        }
+    }
+
+    tenant.interval = std::clamp(interval, MIN_INTERVAL, this->_period * BACKOFF);
+    tenant.last = steady_clock::now();
+    tenant.requests = requests;
+    tenant.usage = tenant.cache->currentMemoryUsage();
+
+    XLOG(DBG, "Cleaned ", tenant.name, " in ", duration<double>(tenant.last - start).count(), "s, ", removed, " items removed, next clean in ", tenant.interval.count(), "ms");
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <rd_utils/concurrency/thread.hh>
+#include <service/cachecache.hh>
+
+namespace cachecache {
+    /**
+     * Cleans the caches on a small pool of threads, the cleans of different caches run in parallel
+     * Each cache is cleaned again after an interval adapted to its memory pressure,
+     * the number of items its last clean removed and the rate of its requests
+     */
+    class Cleaner {
+        public:
+            // shortest time between two cleans of a cache
+            static constexpr std::chrono::milliseconds MIN_INTERVAL = std::chrono::milliseconds(100);
+
+            // an idle or fruitless cache waits up to BACKOFF periods between two cleans
+            static constexpr unsigned int BACKOFF = 8;
+
+            Cleaner();
+            ~Cleaner();
+
+            Cleaner(const Cleaner&) = delete;
+            void operator=(const Cleaner&) = delete;
+
+            /**
+             * @params:
+             *    - workers: the number of threads running the cleans
+             *    - period: the time between two cleans of a cache under pressure
+             */
+            void configure(size_t workers, std::chrono::milliseconds period);
+
+            void addCache(const std::string& name, Cachecache* cache);
+
+            /**
+             * Start the threads
+             * @params:
+             *    - adaptive: clean each cache when it is due, otherwise the caches are only cleaned by cleanAll
+             */
+            void start(bool adaptive);
+
+            /**
+             * Clean every cache once, returns when all the cleans are over
+             * Used by the afap replay, whose cleans follow the seconds of traces
+             */
+            void cleanAll();
+
+            /**
+             * Stop the threads once their running cleans are over
+             */
+            void stop();
+
+        private:
+            struct Tenant {
+                std::string name;
+                Cachecache* cache;
+
+                std::chrono::milliseconds interval;
+                // time, number of requests and memory usage at the end of the last clean
+                std::chrono::steady_clock::time_point last;
+                uint64_t requests = 0;
+                size_t usage = 0;
+            };
+
+            typedef std::pair<std::chrono::steady_clock::time_point, size_t> Due;
+
+            size_t _nb_workers = 1;
+            std::chrono::milliseconds _period = std::chrono::seconds(3);
+            bool _adaptive = true;
+
+            // a tenant is in _due or cleaned by a single worker, never both
+            std::vector<Tenant> _tenants;
+            std::priority_queue<Due, std::vector<Due>, std::greater<Due>> _due;
+
+            std::mutex _mutex;
+            std::condition_variable _cv;
+            // cleans of the running cleanAll
+            size_t _pending = 0;
+            std::condition_variable _done;
+            bool _stop = false;
+
+            std::vector<rd_utils::concurrency::Thread> _workers;
+
+            void work(rd_utils::concurrency::Thread);
+
+            /**
+             * Clean the cache of the tenant and compute the interval until its next clean
+             */
+            void clean(Tenant& tenant);
+    };
+}
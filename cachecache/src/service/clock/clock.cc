@@ -1,38 +1,67 @@
 #include <string>
+#include <time.h>
 
 #include "clock.hh"
 
 using namespace cachecache;
 using namespace std::chrono;
 
-Clock::Clock(): _time(0) {
+Clock::Clock(CLOCK_SOURCE source): _source(source), _time(0) {
+    if (source == CLOCK_SOURCE::REALTIME) {
+        this->_time = 0 - monotonic();
+    }
 }
 
-Clock::Clock(Clock && other): _time(other._time) {
+Clock::Clock(Clock && other): _source(other._source), _time(other._time.load()) {
     other._time = 0;
 }
 
 void Clock::operator=(Clock && other) {
-    this->_time = other._time;
+    this->_source = other._source;
+    this->_time = other._time.load();
     other._time = 0;
 }
 
-unsigned int Clock::time() {
-    return this->_time;
+CLOCK_SOURCE Clock::source() const {
+    return this->_source;
 }
 
-unsigned int Clock::delta(unsigned int i) {
-    return this->_time - i;
+uint64_t Clock::time() const {
+    if (this->_source == CLOCK_SOURCE::REALTIME) {
+        return monotonic() + this->_time.load(std::memory_order_relaxed);
+    }
+
+    return this->_time.load(std::memory_order_relaxed);
+}
+
+uint64_t Clock::delta(uint64_t time) const {
+    return elapsed(time, this->time());
 }
 
 void Clock::update() {
-    this->_time += 1;
+    this->advance(TICKS_PER_SECOND);
+}
+
+void Clock::advance(uint64_t ticks) {
+    if (this->_source == CLOCK_SOURCE::VIRTUAL) {
+        this->_time.fetch_add(ticks, std::memory_order_relaxed);
+    }
+}
+
+void Clock::restore(uint64_t time) {
+    if (this->_source == CLOCK_SOURCE::REALTIME) {
+        this->_time = time - monotonic();
+    } else {
+        this->_time = time;
+    }
 }
 
-std::string Clock::to_string(unsigned int t) {
-    return std::to_string(t);
+uint64_t Clock::elapsed(uint64_t from, uint64_t to) {
+    return to > from ? to - from : 0;
 }
 
-unsigned int Clock::from_string(std::string s) {
-    return std::atoi(s.c_str());
+uint64_t Clock::monotonic() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t) ts.tv_sec * TICKS_PER_SECOND + (uint64_t) ts.tv_nsec / (1000000000 / TICKS_PER_SECOND);
 }
@@ -1,27 +1,86 @@
 #pragma once
 
+#include <atomic>
 #include <chrono>
+#include <cstdint>
 #include <string>
+#include <unordered_map>
 
 namespace cachecache {
+    // where the time of a clock comes from
+    enum class CLOCK_SOURCE {
+        REALTIME // coarse monotonic time of the machine, moves on its own
+        ,VIRTUAL // time of the traces, moved forward by the replay
+    };
+
+    const std::unordered_map<std::string, CLOCK_SOURCE> STR_TO_CLOCK_SOURCE = {
+        {"realtime", CLOCK_SOURCE::REALTIME}
+        , {"virtual", CLOCK_SOURCE::VIRTUAL}
+    };
+
+    /**
+     * Time of a cache in ticks of one millisecond, starting at 0
+     * Read concurrently by the requests, the cleans and the metrics, without locks
+     */
     class Clock {
         public:
-            Clock();
+            static constexpr uint64_t TICKS_PER_SECOND = 1000;
+
+            Clock(CLOCK_SOURCE source = CLOCK_SOURCE::VIRTUAL);
             Clock(Clock &) = delete;
             void operator=(Clock &) = delete;
 
             Clock(Clock &&);
             void operator=(Clock &&);
 
-            unsigned int time();
-            unsigned int delta(unsigned int);
-    
+            CLOCK_SOURCE source() const;
+
+            uint64_t time() const;
+
+            /**
+             * @returns: the ticks elapsed since time, 0 if time is after the current time
+             */
+            uint64_t delta(uint64_t time) const;
+
+            /**
+             * Move a virtual clock one second forward, a realtime clock is left untouched
+             */
             void update();
 
-            std::string to_string(unsigned int);
-            unsigned int from_string(std::string);
+            /**
+             * Move a virtual clock forward, a realtime clock is left untouched
+             */
+            void advance(uint64_t ticks);
+
+            /**
+             * Set the time of a clock saved before a restart, the items of the cache keep their age
+             * A realtime clock goes on from there
+             */
+            void restore(uint64_t time);
+
+            /**
+             * @returns: the ticks between two times, 0 if to is before from (times read concurrently)
+             */
+            static uint64_t elapsed(uint64_t from, uint64_t to);
+
+            static constexpr uint64_t fromSeconds(uint64_t seconds) {
+                return seconds * TICKS_PER_SECOND;
+            }
+
+            static constexpr double toSeconds(uint64_t ticks) {
+                return (double) ticks / (double) TICKS_PER_SECOND;
+            }
 
         private:
-            unsigned int _time = 0;
+            CLOCK_SOURCE _source;
+
+            // virtual clock: the time, updated by the generator
+            // realtime clock: the offset added to the monotonic time (modulo 2^64)
+            std::atomic<uint64_t> _time = 0;
+
+            /**
+             * @returns: the coarse monotonic time of the machine in ticks, a few ms of resolution but no syscall
+             */
+            static uint64_t monotonic();
     };
 }
@@ -0,0 +1,40 @@
+#include "counter.hh"
+
+using namespace cachecache;
+
+ShardedCounter::ShardedCounter() {}
+
+ShardedCounter::ShardedCounter(ShardedCounter&& other) {
+    this->_shards[0].value = other.exchange();
+}
+
+void ShardedCounter::operator=(ShardedCounter&& other) {
+    this->exchange();
+    this->_shards[0].value = other.exchange();
+}
+
+void ShardedCounter::add(uint64_t value) {
+    this->_shards[shard()].value.fetch_add(value, std::memory_order_relaxed);
+}
+
+uint64_t ShardedCounter::load() const {
+    uint64_t sum = 0;
+    for (const auto & shard: this->_shards) {
+        sum += shard.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+uint64_t ShardedCounter::exchange() {
+    uint64_t sum = 0;
+    for (auto & shard: this->_shards) {
+        sum += shard.value.exchange(0, std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+unsigned int ShardedCounter::shard() {
+    static std::atomic<unsigned int> next = 0;
+    thread_local unsigned int index = next.fetch_add(1, std::memory_order_relaxed) % SHARDS;
+    return index;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace cachecache {
+    /**
+     * Counter incremented concurrently by many threads
+     * Each thread writes in its own cache line, the shards are summed on read
+     */
+    class ShardedCounter {
+        public:
+            static constexpr unsigned int SHARDS = 16;
+
+            ShardedCounter();
+
+            ShardedCounter(const ShardedCounter&) = delete;
+            void operator=(const ShardedCounter&) = delete;
+
+            ShardedCounter(ShardedCounter&&);
+            void operator=(ShardedCounter&&);
+
+            void add(uint64_t value = 1);
+
+            uint64_t load() const;
+
+            /**
+             * @returns: the value of the counter, that is reset to 0
+             */
+            uint64_t exchange();
+
+            /**
+             * @returns: the index of the shard written by the calling thread
+             */
+            static unsigned int shard();
+
+        private:
+            struct alignas(64) Shard {
+                std::atomic<uint64_t> value = 0;
+            };
+
+            std::array<Shard, SHARDS> _shards;
+    };
+}
@@ -0,0 +1,47 @@
+#include "delta.hh"
+#include <algorithm>
+
+using namespace cachecache;
+
+DeltaHistogram::DeltaHistogram() {}
+
+DeltaHistogram::DeltaHistogram(DeltaHistogram&& other) {
+    *this = std::move(other);
+}
+
+void DeltaHistogram::operator=(DeltaHistogram&& other) {
+    this->exchange();
+
+    auto snapshot = other.exchange();
+    for (unsigned int i = 0; i < NB_BUCKETS; i++) {
+        this->_shards[0].counts[i] = snapshot.counts[i];
+    }
+    this->_shards[0].sum = snapshot.sum;
+}
+
+void DeltaHistogram::record(uint64_t delta) {
+    auto & shard = this->_shards[ShardedCounter::shard()];
+    shard.counts[bucket(delta)].fetch_add(1, std::memory_order_relaxed);
+    shard.sum.fetch_add(delta, std::memory_order_relaxed);
+}
+
+DeltaHistogram::Snapshot DeltaHistogram::exchange() {
+    Snapshot snapshot = {};
+    for (auto & shard: this->_shards) {
+        for (unsigned int i = 0; i < NB_BUCKETS; i++) {
+            snapshot.counts[i] += shard.counts[i].exchange(0, std::memory_order_relaxed);
+        }
+        snapshot.sum += shard.sum.exchange(0, std::memory_order_relaxed);
+    }
+
+    return snapshot;
+}
+
+uint64_t DeltaHistogram::lower(unsigned int bucket) {
+    return bucket == 0 ? 0 : uint64_t(1) << (bucket - 1);
+}
+
+unsigned int DeltaHistogram::bucket(uint64_t delta) {
+    // the last bucket also holds the deltas above its lower bound
+    return delta == 0 ? 0 : std::min(64 - __builtin_clzll(delta), (int) NB_BUCKETS - 1);
+}
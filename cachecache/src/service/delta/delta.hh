@@ -0,0 +1,54 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+#include <service/counter/counter.hh>
+
+namespace cachecache {
+    /**
+     * Counts the reuse deltas of the hits of a cache in power of two buckets, between two exports
+     * Bucket 0 counts the deltas of 0, bucket i > 0 the deltas in [2^(i-1), 2^i[, the last bucket everything above 2^31 ticks
+     * Hits are recorded concurrently, each thread writes in its own shard
+     */
+    class DeltaHistogram {
+        public:
+            static constexpr unsigned int NB_BUCKETS = 33;
+
+            struct Snapshot {
+                std::array<uint64_t, NB_BUCKETS> counts;
+                uint64_t sum;
+            };
+
+            DeltaHistogram();
+
+            DeltaHistogram(const DeltaHistogram&) = delete;
+            void operator=(const DeltaHistogram&) = delete;
+
+            DeltaHistogram(DeltaHistogram&&);
+            void operator=(DeltaHistogram&&);
+
+            void record(uint64_t delta);
+
+            /**
+             * @returns: the deltas recorded since the last exchange, the histogram is reset
+             */
+            Snapshot exchange();
+
+            /**
+             * @returns: the smallest delta counted in the bucket
+             */
+            static uint64_t lower(unsigned int bucket);
+
+        private:
+            struct alignas(64) Shard {
+                std::array<std::atomic<uint64_t>, NB_BUCKETS> counts = {};
+                std::atomic<uint64_t> sum = 0;
+            };
+
+            std::array<Shard, ShardedCounter::SHARDS> _shards;
+
+            static unsigned int bucket(uint64_t delta);
+    };
+}
@@ -0,0 +1,67 @@
+#include "expiry.hh"
+
+#include <algorithm>
+#include <service/counter/counter.hh>
+
+using namespace cachecache;
+
+ExpiryIndex::ExpiryIndex(uint64_t granularity):
+    _granularity(std::max(granularity, (uint64_t) 1))
+    , _shards(std::make_unique<Shard[]>(SHARDS)) {}
+
+ExpiryIndex::ExpiryIndex(ExpiryIndex&& other):
+    _granularity(other._granularity)
+    , _shards(std::move(other._shards))
+    , _size(other._size.load()) {
+    other._shards = std::make_unique<Shard[]>(SHARDS);
+    other._size = 0;
+}
+
+void ExpiryIndex::operator=(ExpiryIndex&& other) {
+    this->_granularity = other._granularity;
+    this->_shards = std::move(other._shards);
+    this->_size = other._size.load();
+
+    other._shards = std::make_unique<Shard[]>(SHARDS);
+    other._size = 0;
+}
+
+void ExpiryIndex::insert(std::string_view key, uint64_t expiry) {
+    uint64_t bucket = (expiry + this->_granularity - 1) / this->_granularity;
+
+    // the threads of the requests are spread on the shards as for the counters
+    auto & shard = this->_shards[ShardedCounter::shard() % SHARDS];
+    {
+        std::scoped_lock lock(shard.mutex);
+        shard.buckets[bucket].emplace_back(key);
+    }
+    this->_size.fetch_add(1, std::memory_order_relaxed);
+}
+
+size_t ExpiryIndex::pop(uint64_t now, size_t limit, std::string& keys, std::vector<size_t>& offsets) {
+    size_t nb = 0;
+    for (unsigned int i = 0; i < SHARDS && nb < limit; i++) {
+        auto & shard = this->_shards[i];
+        std::scoped_lock lock(shard.mutex);
+
+        auto it = shard.buckets.begin();
+        while (it != shard.buckets.end() && it->first * this->_granularity <= now && nb < limit) {
+            auto & bucket = it->second;
+            while (!bucket.empty() && nb < limit) {
+                offsets.push_back(keys.size());
+                keys.append(bucket.back());
+                bucket.pop_back();
+                nb++;
+            }
+
+            if (bucket.empty()) it = shard.buckets.erase(it);
+        }
+    }
+
+    this->_size.fetch_sub(nb, std::memory_order_relaxed);
+    return nb;
+}
+
+uint64_t ExpiryIndex::size() const {
+    return this->_size.load(std::memory_order_relaxed);
+}
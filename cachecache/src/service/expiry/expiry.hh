@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace cachecache {
+    /**
+     * Keys by expiry time, in buckets of granularity ticks
+     * Used to reap the expired items without scanning the cache, when cachelib does not know their ttl
+     * The entries are never updated: a key rewritten or removed since its insertion is still returned, the caller checks the item
+     * Each thread inserts in its own shard, the shards are all read by pop
+     */
+    class ExpiryIndex {
+        public:
+            static constexpr unsigned int SHARDS = 16;
+
+            ExpiryIndex(uint64_t granularity = 1);
+
+            ExpiryIndex(const ExpiryIndex&) = delete;
+            void operator=(const ExpiryIndex&) = delete;
+
+            ExpiryIndex(ExpiryIndex&&);
+            void operator=(ExpiryIndex&&);
+
+            void insert(std::string_view key, uint64_t expiry);
+
+            /**
+             * Take out the keys of the buckets whose items are all expired at now
+             * @params:
+             *    - limit: the maximal number of keys taken out, the others are left for the next pop
+             *    - keys, offsets: output, the keys are appended one after the other to keys, starting at offsets
+             * @returns: the number of keys taken out
+             */
+            size_t pop(uint64_t now, size_t limit, std::string& keys, std::vector<size_t>& offsets);
+
+            uint64_t size() const;
+
+        private:
+            struct Shard {
+                std::mutex mutex;
+                // the keys by bucket, a bucket b holds the expiries in ((b - 1) * granularity, b * granularity]
+                std::map<uint64_t, std::vector<std::string>> buckets;
+            };
+
+            // ticks per bucket
+            uint64_t _granularity;
+
+            std::unique_ptr<Shard[]> _shards;
+            std::atomic<uint64_t> _size = 0;
+    };
+}
@@ -0,0 +1,193 @@
+#include "exporter.hh"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <charconv>
+#include <stdexcept>
+
+#include "folly/logging/xlog.h"
+#include "folly/logging/LogLevel.h"
+
+using namespace cachecache;
+using namespace rd_utils::concurrency;
+
+namespace {
+    void metric(std::string& out, const std::string& name, const std::string& type, const std::string& help) {
+        out += "# TYPE " + name + " " + type + "\n";
+        out += "# HELP " + name + " " + help + "\n";
+    }
+
+    void sample(std::string& out, const std::string& name, const std::string& labels, double value) {
+        char number[64];
+        auto res = std::to_chars(number, number + sizeof(number), value);
+
+        out += name;
+        out += "{" + labels + "} ";
+        out.append(number, res.ptr - number);
+        out += "\n";
+    }
+}
+
+Exporter::Exporter() {}
+
+Exporter::~Exporter() {
+    this->stop();
+}
+
+void Exporter::configure(const std::string& address, int port) {
+    this->_address = address;
+    this->_port = port;
+}
+
+void Exporter::addCache(const std::string& name, const Cachecache* cache) {
+    this->_caches.emplace_back(name, cache);
+}
+
+void Exporter::setMarket(const Market* market) {
+    this->_market = market;
+}
+
+void Exporter::start() {
+    this->_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (this->_fd < 0) throw std::runtime_error(std::string("socket: ") + strerror(errno));
+
+    int one = 1;
+    setsockopt(this->_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(this->_port);
+    if (inet_pton(AF_INET, this->_address.c_str(), &addr.sin_addr) != 1) {
+        throw std::runtime_error("Invalid exporter address " + this->_address);
+    }
+
+    if (bind(this->_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || listen(this->_fd, 16) < 0) {
+        throw std::runtime_error("Could not listen on " + this->_address + ":" + std::to_string(this->_port) + " - " + strerror(errno));
+    }
+
+    XLOG(INFO, "Serving metrics on http://", this->_address, ":", this->_port, "/metrics");
+    this->_running = true;
+    this->_thread = spawn(this, &Exporter::run);
+}
+
+void Exporter::stop() {
+    if (this->_running) {
+        this->_running = false;
+        join(this->_thread);
+    }
+
+    if (this->_fd >= 0) {
+        close(this->_fd);
+        this->_fd = -1;
+    }
+}
+
+void Exporter::run(Thread) {
+    pollfd listener = {this->_fd, POLLIN, 0};
+    while (this->_running) {
+        int n = poll(&listener, 1, POLL_TIMEOUT_MS);
+        if (n <= 0) continue;
+
+        int client = accept4(this->_fd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0) continue;
+
+        // a slow scraper must not hold the exporter forever
+        timeval timeout = {1, 0};
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        this->serve(client);
+        close(client);
+    }
+}
+
+void Exporter::serve(int client) {
+    std::string request;
+    char buffer[1024];
+    while (request.find("\r\n\r\n") == std::string::npos && request.size() < MAX_REQUEST) {
+        ssize_t n = recv(client, buffer, sizeof(buffer), 0);
+        if (n <= 0) return;
+        request.append(buffer, n);
+    }
+
+    std::string status, type, body;
+    if (request.rfind("GET /metrics ", 0) == 0 || request.rfind("GET / ", 0) == 0) {
+        status = "200 OK";
+        type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+        body = this->format();
+    } else {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "Not found\n";
+    }
+
+    std::string response = "HTTP/1.1 " + status + "\r\n"
+        + "Content-Type: " + type + "\r\n"
+        + "Content-Length: " + std::to_string(body.size()) + "\r\n"
+        + "Connection: close\r\n\r\n"
+        + body;
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t n = send(client, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) return;
+        sent += n;
+    }
+}
+
+std::string Exporter::format() const {
+    std::vector<std::pair<std::string, CacheStats>> stats;
+    stats.reserve(this->_caches.size());
+    for (const auto & [name, cache]: this->_caches) {
+        stats.emplace_back(name, cache->stats());
+    }
+
+    std::string out;
+
+    metric(out, "cachecache_hits", "counter", "Number of hits");
+    for (const auto & [name, s]: stats) sample(out, "cachecache_hits_total", "cache=\"" + name + "\"", s.hits);
+
+    metric(out, "cachecache_requests", "counter", "Number of get requests");
+    for (const auto & [name, s]: stats) sample(out, "cachecache_requests_total", "cache=\"" + name + "\"", s.requests);
+
+    metric(out, "cachecache_cache_size_bytes", "gauge", "Size of the cache");
+    for (const auto & [name, s]: stats) sample(out, "cachecache_cache_size_bytes", "cache=\"" + name + "\"", s.cache_size);
+
+    metric(out, "cachecache_memory_usage_bytes", "gauge", "Memory used by the items of the cache");
+    for (const auto & [name, s]: stats) sample(out, "cachecache_memory_usage_bytes", "cache=\"" + name + "\"", s.memory_usage);
+
+    metric(out, "cachecache_eviction_target", "gauge", "Reuse delta above which the items are removed by the last clean, in ms");
+    for (const auto & [name, s]: stats) sample(out, "cachecache_eviction_target", "cache=\"" + name + "\"", s.eviction_target);
+
+    metric(out, "cachecache_reuse_delta", "gauge", "Estimated quantiles of the reuse delta of the hits, in ms");
+    for (const auto & [name, s]: stats) {
+        for (int i = 0; i < 3; i++) {
+            char quantile[32];
+            auto res = std::to_chars(quantile, quantile + sizeof(quantile), s.quantiles[i]);
+            sample(out, "cachecache_reuse_delta", "cache=\"" + name + "\",quantile=\"" + std::string(quantile, res.ptr) + "\"", s.deltas[i]);
+        }
+    }
+
+    if (this->_market != nullptr) {
+        metric(out, "cachecache_wallet_bytes", "gauge", "Memory credit of the cache on the market");
+        for (const auto & [name, cache]: this->_caches) {
+            auto market = this->_market->getStats(name);
+            if (market != nullptr) sample(out, "cachecache_wallet_bytes", "cache=\"" + name + "\"", market->wallet.load());
+        }
+
+        metric(out, "cachecache_memory_bought_bytes", "counter", "Memory bought on the market");
+        for (const auto & [name, cache]: this->_caches) {
+            auto market = this->_market->getStats(name);
+            if (market != nullptr) sample(out, "cachecache_memory_bought_bytes_total", "cache=\"" + name + "\"", market->memory_bought.load());
+        }
+    }
+
+    out += "# EOF\n";
+    return out;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include <rd_utils/concurrency/thread.hh>
+#include <service/cachecache.hh>
+#include <service/market.hh>
+
+namespace cachecache {
+    /**
+     * HTTP endpoint serving the live state of the caches and of the market in the OpenMetrics text format
+     * The values are read from atomics and snapshots, the scrapes never block the requests of the caches
+     */
+    class Exporter {
+        public:
+            Exporter();
+            ~Exporter();
+
+            Exporter(const Exporter&) = delete;
+            void operator=(const Exporter&) = delete;
+
+            void configure(const std::string& address, int port);
+
+            void addCache(const std::string& name, const Cachecache* cache);
+            void setMarket(const Market* market);
+
+            void start();
+            void stop();
+
+            void run(rd_utils::concurrency::Thread);
+
+            /**
+             * @returns: the body of a scrape
+             */
+            std::string format() const;
+
+        private:
+            // maximal size of a request header
+            static constexpr size_t MAX_REQUEST = 8192;
+            // time between two checks of the stop flag
+            static constexpr int POLL_TIMEOUT_MS = 200;
+
+            std::string _address;
+            int _port = 0;
+            int _fd = -1;
+
+            std::vector<std::pair<std::string, const Cachecache*>> _caches;
+            const Market* _market = nullptr;
+
+            std::atomic<bool> _running = false;
+            rd_utils::concurrency::Thread _thread;
+
+            void serve(int client);
+    };
+}
@@ -1,12 +1,13 @@
 #include <service/generator.hh>
+#include <algorithm>
 #include <optional>
 #include <rd_utils/concurrency/thread.hh>
 #include <rd_utils/foreign/CLI11.hh>
 #include <string>
 #include <string.h>
+#include <chrono>
+#include <thread>
 #include <vector>
-#include <fstream>
-#include <sstream>
 #include <unordered_map>
 
 #include "folly/logging/xlog.h"
@@ -18,6 +19,12 @@ using namespace cachecache;
 
 //rd_utils::concurrency::signal<> exitSignal;
 
+namespace {
+    uint64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+}
+
 Generator::Generator() {
 }
 
@@ -25,18 +32,26 @@ Generator::~Generator(){
 }
 
 Generator::Generator(Generator&& other):
-    _traces(std::move(other._traces))
+    _target_time(other._target_time)
+    , _traces(std::move(other._traces))
     , _nb_seconds(other._nb_seconds)
+    , _key_mode(other._key_mode)
     , _target(std::move(other._target))
     , _clock(std::move(other._clock))
+    , _metrics(other._metrics)
+    , _rounds(other._rounds)
     , _threads(std::move(other._threads))
+    , _loop(other._loop)
+    , _latency_metrics(other._latency_metrics)
+    , _batch_size(other._batch_size)
+    , _nb_workers(other._nb_workers)
     , _finished(other._finished)
-    , _stop(other._stop)
+    , _stop(other._stop.load())
     , _ignored_lines(other._ignored_lines)
-    , _time(other._time)
-    , _target_time(other._target_time) {
+    , _time(other._time) {
 
     other._nb_seconds = 0;
+    other._rounds = nullptr;
     other._stop = false;
     other._ignored_lines = 0;
     other._time = 0;
@@ -47,11 +62,19 @@ void Generator::operator=(Generator&& other) {
     this->_traces = std::move(other._traces);
     this->_nb_seconds = other._nb_seconds;
     other._nb_seconds = 0;
+    this->_key_mode = other._key_mode;
     this->_target = std::move(other._target);
     this->_clock = std::move(other._clock);
+    this->_metrics = other._metrics;
+    this->_rounds = other._rounds;
+    other._rounds = nullptr;
+    this->_latency_metrics = other._latency_metrics;
     this->_threads = std::move(other._threads);
+    this->_batch_size = other._batch_size;
+    this->_nb_workers = other._nb_workers;
+    this->_loop = other._loop;
     this->_finished = other._finished;
-    this->_stop = other._stop;
+    this->_stop = other._stop.load();
     other._stop = false;
     this->_ignored_lines = other._ignored_lines;
     other._ignored_lines = 0;
@@ -62,16 +85,45 @@ void Generator::operator=(Generator&& other) {
     other._target_time = 1;
 }
 
-void Generator::configure(const std::string & traces, int nb_seconds, int frequency, Cachecache* target, Clock* clock, std::shared_ptr<bool> finished) {
+void Generator::configure(const std::string & traces, int nb_seconds, int frequency, KEY_MODE key_mode, Cachecache* target, Clock* clock, Metrics* metrics, std::shared_ptr<bool> finished) {
     this->_traces = traces;
     this->_nb_seconds = nb_seconds;
+    this->_key_mode = key_mode;
     this->_target = target;
     this->_clock = clock;
+    this->_metrics = metrics;
     this->_finished = finished;
 
+    for (const auto & [name, operation]: STR_TO_OPERATION) {
+        auto & handles = this->_latency_metrics[static_cast<size_t>(operation)];
+        handles[0] = metrics->registerMetric("latency_ns", {{"client", target->getName()}, {"operation", name}, {"percentile", "50"}});
+        handles[1] = metrics->registerMetric("latency_ns", {{"client", target->getName()}, {"operation", name}, {"percentile", "99"}});
+        handles[2] = metrics->registerMetric("latency_ns", {{"client", target->getName()}, {"operation", name}, {"percentile", "99.9"}});
+    }
+
     this->_target_time = 1.f / (float)frequency;
 }
 
+void Generator::setBatchSize(unsigned int size) {
+    this->_batch_size = std::max(size, (unsigned int) 1);
+}
+
+void Generator::setWorkers(unsigned int nb) {
+    this->_nb_workers = std::max(nb, (unsigned int) 1);
+}
+
+void Generator::setLoop(LOOP loop) {
+    this->_loop = loop;
+}
+
+void Generator::stop() {
+    this->_stop = true;
+}
+
+void Generator::setRounds(Rounds* rounds) {
+    this->_rounds = rounds;
+}
+
 void Generator::dispose() {
     if(!this->_stop) {
         LOG_DEBUG("Dispose")
@@ -87,29 +139,36 @@ void Generator::run(Thread t) {
 }
 
 void Generator::run() {
-    std::ifstream f(this->_traces);
-
-    if(f.is_open()) {
-        std::string l;
-        int i = 0;
-
-        this->_timer.reset();
-        for(l; getline(f, l); ) {
-            if(this->_stop) break;
-            try {
-                this->process(l);
-            } catch (...) {
-                XLOG(ERR, "ERROR WHILE PROCESSING LINE ", i);
-            }
-            //usleep(100);
-            i++;
+    // the replayers are created here, once the generator will not move anymore
+    this->_replayers.clear();
+    for (unsigned int i = 0; i < this->_nb_workers; i++) {
+        this->_replayers.push_back(std::make_unique<Replayer>(this));
+    }
+
+    if (BinaryTraceReader::isBinary(this->_traces)) {
+        // binary traces only store the hash of the keys
+        if (this->_key_mode == KEY_MODE::FULL) {
+            LOG_ERROR("Binary traces ", this->_traces, " cannot be replayed with full keys");
+            exit(-1);
         }
-        f.close();
-        LOG_INFO("Number of ignored lines ", this->_ignored_lines);
-        LOG_INFO("Current time ", this->_time);
+
+        BinaryTraceReader reader;
+        if (!reader.open(this->_traces)) {
+            LOG_ERROR("Invalid binary traces at ", this->_traces);
+            exit(-1);
+        }
+
+        if (this->_nb_workers > 1 || this->_loop == LOOP::OPEN) this->replayParallel(reader);
+        else this->replay(reader);
     } else {
-        LOG_ERROR("Could not open traces files at ", this->_traces);
-        exit(-1);
+        TraceReader reader;
+        if (!reader.open(this->_traces, this->_key_mode == KEY_MODE::HASH)) {
+            LOG_ERROR("Could not open traces files at ", this->_traces);
+            exit(-1);
+        }
+
+        if (this->_nb_workers > 1 || this->_loop == LOOP::OPEN) this->replayParallel(reader);
+        else this->replay(reader);
     }
 
     this->_target->push_metrics();
@@ -118,65 +177,320 @@ void Generator::run() {
         join(t);
     }
 
+    // the other generators go on with their rounds
+    if (this->_rounds != nullptr) this->_rounds->leave();
+
     XLOG(INFO, "FINISHED");
     *this->_finished = true;
 }
 
-void Generator::process(std::string& l) {
-    line current = this->parseLine(l);
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================       SEQUENTIAL        ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+template <typename Reader>
+void Generator::replay(Reader& reader) {
+    line current;
+
+    this->_timer.reset();
+    while (!this->_stop && reader.next(current)) {
+        this->process(current);
+    }
 
-    if(std::atoi(current.timestamp.c_str()) != this->_time) {
+    this->_replayers[0]->flush();
+    this->_ignored_lines = reader.getIgnoredLines();
+    LOG_INFO("Number of ignored lines ", this->_ignored_lines);
+    LOG_INFO("Current time ", this->_time);
+}
+
+void Generator::process(line& current) {
+    if(current.timestamp != this->_time) {
+        this->_replayers[0]->flush();
+        this->exportLatencies();
         this->_clock->update();
         this->_target->push_metrics();
         this->_time++;
+        if (this->_rounds != nullptr) this->_rounds->arrive();
+        else this->pace();
 
-        if (this->_timer.time_since_start() > this->_target_time) {
-            XLOG(INFO, "Processed second in ", this->_timer.time_since_start(), "s instead of ", this->_target_time, "s");
-        } else {
-            auto duration = this->_target_time - this->_timer.time_since_start();
-            //XLOG(INFO, "Sleep for ", duration, "s");
-            this->_timer.sleep(duration);
+        if (this->_nb_seconds > 0 && current.timestamp >= (uint32_t) this->_nb_seconds) {
+            this->_stop = true;
         }
-        this->_timer.reset();
+    }
 
-        if (this->_nb_seconds > 0 && std::atoi(current.timestamp.c_str()) >= this->_nb_seconds) {
-            this->_stop = true;
+    this->_replayers[0]->execute(current);
+}
+
+void Generator::pace() {
+    if (this->_timer.time_since_start() > this->_target_time) {
+        XLOG(INFO, "Processed second in ", this->_timer.time_since_start(), "s instead of ", this->_target_time, "s");
+    } else {
+        auto duration = this->_target_time - this->_timer.time_since_start();
+        //XLOG(INFO, "Sleep for ", duration, "s");
+        this->_timer.sleep(duration);
+    }
+    this->_timer.reset();
+}
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================        PARALLEL         ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+template <typename Reader>
+void Generator::replayParallel(Reader& reader) {
+    this->_barrier = std::make_unique<std::barrier<SecondEnd>>(this->_nb_workers + 1, SecondEnd{this});
+    this->_replayed = false;
+    this->_started = false;
+    this->_current = 1;
+
+    for (auto & replayer: this->_replayers) {
+        this->_threads.push_back(spawn(replayer.get(), &Replayer::run));
+    }
+
+    line pending;
+    bool has_pending = false;
+
+    // the reader prepares the next second while the workers replay the current one
+    bool more = this->dispatch(reader, pending, has_pending);
+    bool first = true;
+    while (true) {
+        if (!more) this->_replayed = true;
+        this->_barrier->arrive_and_wait();
+        if (!more) break;
+
+        // as fast as possible, the rounds are done by the workers at the end of the seconds
+        if (this->_rounds == nullptr) {
+            // a second lasts from barrier to barrier, so the time of the workers is counted and not only the dispatch
+            if (!first && this->_timer.time_since_start() > this->_target_time) {
+                XLOG(INFO, "Processed second in ", this->_timer.time_since_start(), "s instead of ", this->_target_time, "s");
+            }
+            this->_timer.reset();
+        }
+
+        first = false;
+        more = this->dispatch(reader, pending, has_pending);
+
+        // the workers are still replaying the second, the next barrier is at the earliest at its target time
+        if (this->_rounds == nullptr && this->_timer.time_since_start() < this->_target_time) {
+            this->_timer.sleep(this->_target_time - this->_timer.time_since_start());
+        }
+    }
+
+    this->_ignored_lines = reader.getIgnoredLines();
+    LOG_INFO("Number of ignored lines ", this->_ignored_lines);
+    LOG_INFO("Current time ", this->_time);
+}
+
+template <typename Reader>
+bool Generator::dispatch(Reader& reader, line& pending, bool& has_pending) {
+    if (this->_stop) return false;
+    if (!has_pending) {
+        if (!reader.next(pending)) return false;
+        has_pending = true;
+    }
+
+    uint32_t second = pending.timestamp;
+    if (this->_nb_seconds > 0 && second >= (uint32_t) this->_nb_seconds) return false;
+
+    unsigned int next = this->_current ^ 1;
+    do {
+        // the requests of a key always go to the same worker, to keep their order
+        uint64_t hash = this->_key_mode == KEY_MODE::HASH ? pending.hash : std::hash<std::string_view>{}(pending.key);
+        this->_replayers[hash % this->_nb_workers]->_queues[next].push_back(pending);
+
+        if (!reader.next(pending)) {
+            has_pending = false;
+            return true;
+        }
+    } while (pending.timestamp == second);
+
+    return true;
+}
+
+void Generator::SecondEnd::operator()() noexcept {
+    // the first barrier only starts the replay of the first second
+    if (this->generator->_started) {
+        this->generator->exportLatencies();
+        this->generator->_clock->update();
+        this->generator->_target->push_metrics();
+        this->generator->_time++;
+
+        // the workers and the reader wait for the round, no request is replayed meanwhile
+        if (this->generator->_rounds != nullptr) this->generator->_rounds->arrive();
+    }
+
+    this->generator->_started = true;
+    this->generator->_current ^= 1;
+}
+
+void Generator::exportLatencies() {
+    for (auto & replayer: this->_replayers) {
+        for (size_t i = 0; i < NB_OPERATIONS; i++) {
+            this->_latencies[i].merge(replayer->_latencies[i]);
+            replayer->_latencies[i].reset();
         }
     }
 
-    std::string value('a', current.valuesize);
-    //XLOG(ERR, "Could not execute line [", l, "]");
+    for (size_t i = 0; i < NB_OPERATIONS; i++) {
+        auto & latencies = this->_latencies[i];
+        if (latencies.count() == 0) continue;
+
+        this->_metrics->push(this->_latency_metrics[i][0], latencies.quantile(0.5));
+        this->_metrics->push(this->_latency_metrics[i][1], latencies.quantile(0.99));
+        this->_metrics->push(this->_latency_metrics[i][2], latencies.quantile(0.999));
+        latencies.reset();
+    }
+}
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================        REPLAYER         ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+Replayer::Replayer(Generator* generator):
+    _generator(generator) {
+    this->_batch.reserve(generator->_batch_size);
+}
+
+void Replayer::run(Thread) {
+    Generator& generator = *this->_generator;
+    while (true) {
+        generator._barrier->arrive_and_wait();
+        if (generator._replayed) break;
+
+        auto & queue = this->_queues[generator._current];
+        if (generator._loop == LOOP::OPEN && !queue.empty()) {
+            // the requests of the second are spread evenly over its duration
+            uint64_t start = now();
+            uint64_t interval = generator._target_time * 1e9 / queue.size();
+            for (size_t i = 0; i < queue.size(); i++) {
+                this->schedule(start + i * interval);
+                this->execute(queue[i]);
+            }
+            this->_intended = 0;
+        } else {
+            for (const auto & l: queue) {
+                this->execute(l);
+            }
+        }
+
+        this->flush();
+        queue.clear();
+    }
+}
+
+void Replayer::schedule(uint64_t intended) {
+    this->_intended = intended;
+
+    // sleeping is too coarse for the last microseconds before the intended time, they are spent spinning
+    uint64_t current = now();
+    if (intended > current + SPIN_NS) {
+        std::this_thread::sleep_for(std::chrono::nanoseconds(intended - current - SPIN_NS));
+    }
+
+    while (now() < intended) {}
+}
+
+void Replayer::execute(const line& current) {
+    // in open loop the time spent behind schedule counts in the latency (coordinated omission)
+    uint64_t start = this->_intended != 0 ? this->_intended : now();
+
+    bool is_get = current.operation == OPERATION::GET || current.operation == OPERATION::GETS;
+    if (this->_generator->_batch_size > 1 && is_get) {
+        this->_batch.push_back(current);
+        this->_batch_starts.push_back(start);
+        if (this->_batch.size() >= this->_generator->_batch_size) this->flush();
+        return;
+    }
+
+    // the pending gets were issued before this request
+    this->flush();
+
+    // the values are numbers, so the incr and decr of the traces are executed instead of failing
+    if (this->_value.size() < (size_t) current.valuesize) {
+        this->_value.resize(current.valuesize, '0');
+    }
+
+    std::string_view value(this->_value.data(), current.valuesize);
+    auto key = this->_generator->key(current);
+    auto target = this->_generator->_target;
+    uint32_t ttl = std::max(current.TTL, 0);
+    uint64_t number;
     switch (current.operation) {
         case OPERATION::GET:
         case OPERATION::GETS:
-            this->_target->get(current.key);
+            target->get(key);
             break;
         case OPERATION::SET:
+            target->put(key, value, 0, ttl);
+            break;
         case OPERATION::ADD:
-            this->_target->put(current.key, value);
+            target->add(key, value, 0, ttl);
+            break;
+        case OPERATION::REPLACE:
+            target->replace(key, value, 0, ttl);
+            break;
+        case OPERATION::CAS:
+            // the traces do not keep the version read by the client, the current one is used
+            target->cas(key, value, 0, ttl, target->version(key));
+            break;
+        case OPERATION::APPEND:
+            target->append(key, value);
+            break;
+        case OPERATION::PREPEND:
+            target->prepend(key, value);
+            break;
+        case OPERATION::DELETE:
+            target->remove(key);
+            break;
+        case OPERATION::INCR:
+            target->incr(key, 1, number);
+            break;
+        case OPERATION::DECR:
+            target->decr(key, 1, number);
             break;
-
-        default:
-            XLOG(ERR, "Unsupported operation");
-            this->_target->get(current.key);
     }
+
+    this->_latencies[static_cast<size_t>(current.operation)].record(now() - start);
 }
 
+void Replayer::flush() {
+    if (this->_batch.empty()) return;
 
-// UTILS
+    this->_batch_keys.clear();
+    for (const auto & l: this->_batch) {
+        this->_batch_keys.push_back(this->_generator->key(l));
+    }
 
-line Generator::parseLine(const std::string & l) const {
-    line res;
+    this->_generator->_target->getMany(this->_batch_keys, this->_batch_hits);
 
-    std::vector<std::string> tokens = rd_utils::utils::tokenize(l, {","}, {","});
+    uint64_t end = now();
+    for (size_t i = 0; i < this->_batch.size(); i++) {
+        this->_latencies[static_cast<size_t>(this->_batch[i].operation)].record(end - this->_batch_starts[i]);
+    }
 
-    res.timestamp = tokens[0];
-    res.key = std::to_string(std::hash<std::string>{}(tokens[1]));
-    res.keysize = res.key.size(); //std::stoi(tokens[2]);
-    res.valuesize = std::stoi(tokens[3]) * 2;
-    res.clientid = std::stoi(tokens[4]);
-    res.operation = STR_TO_OPERATION.at(tokens[5]);
-    res.TTL = std::stoi(tokens[6]);
+    this->_batch.clear();
+    this->_batch_starts.clear();
+}
+
+// UTILS
 
-    return res;
-} 
+facebook::cachelib::LruAllocator::Key Generator::key(const line & l) const {
+    if (this->_key_mode == KEY_MODE::FULL) {
+        return facebook::cachelib::LruAllocator::Key{l.key};
+    }
+
+    // the key points to the hash stored in the line (or to the mapped traces in full mode), it must not outlive it
+    return facebook::cachelib::LruAllocator::Key{reinterpret_cast<const char*>(&l.hash), sizeof(l.hash)};
+}
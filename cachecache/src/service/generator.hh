@@ -8,52 +8,106 @@
 #include <unordered_map>
 #include <vector>
 #include <memory>
+#include <array>
+#include <atomic>
+#include <barrier>
 
 #include "cachecache.hh"
 #include <service/clock/clock.hh>
+#include <service/metrics/metrics.hh>
+#include <service/rounds/rounds.hh>
+#include <service/latency/histogram.hh>
+#include <service/traces/trace.hh>
+#include <service/traces/reader.hh>
+#include <service/traces/binary.hh>
 
 namespace cachecache {
-    // will manage first get, gets, set, add, replace, append, delete
-    enum class OPERATION {
-        GET
-        ,GETS // get with CAS, not implemented in redis
-        ,SET
-        ,ADD // set only if key does not exists, SET with NX option in redis
-        ,REPLACE // set + XX option in redis
-        ,CAS // compare and swap, not implemented in redis
-        ,APPEND
-        ,PREPEND
-        ,DELETE
-        ,INCR
-        ,DECR
+    // how trace keys are turned into cachelib keys
+    enum class KEY_MODE {
+        HASH // the 8 raw bytes of the 64 bits hash of the key
+        ,FULL // the original key, safe against hash collisions
     };
 
-    const std::unordered_map<std::string, OPERATION> STR_TO_OPERATION = {
-        {"get", OPERATION::GET}
-        , {"gets", OPERATION::GETS}
-        , {"set", OPERATION::SET}
-        , {"add", OPERATION::ADD}
-        , {"replace", OPERATION::REPLACE}
-        , {"cas", OPERATION::CAS}
-        , {"append", OPERATION::APPEND}
-        , {"prepend", OPERATION::PREPEND}
-        , {"delete", OPERATION::DELETE}
-        , {"incr", OPERATION::INCR}
-        , {"decr", OPERATION::DECR}
+    const std::unordered_map<std::string, KEY_MODE> STR_TO_KEY_MODE = {
+        {"hash", KEY_MODE::HASH}
+        , {"full", KEY_MODE::FULL}
     };
 
-    struct line {
-        std::string timestamp;
-        std::string key;
-        int keysize;
-        int valuesize;
-        int clientid;
-        OPERATION operation;
-        int TTL;
+    // how the latencies of the requests are measured
+    enum class LOOP {
+        CLOSED // a request is sent once the previous one is answered, latency = service time
+        ,OPEN // the requests of a second are scheduled evenly, latency is measured from the intended send time
+    };
+
+    const std::unordered_map<std::string, LOOP> STR_TO_LOOP = {
+        {"closed", LOOP::CLOSED}
+        , {"open", LOOP::OPEN}
     };
 
     //extern rd_utils::concurrency::signal<> exitSignal;
 
+    class Generator;
+
+    /**
+     * Executes the requests of the traces against the cache
+     * Each replay thread has its own replayer, with its own batching buffers
+     */
+    class Replayer {
+    public:
+        Replayer(Generator* generator);
+
+        Replayer(const Replayer&) = delete;
+        void operator=(const Replayer&) = delete;
+
+        /**
+         * Execute a request, or batch it if it is a get
+         */
+        void execute(const line&);
+
+        /**
+         * Wait until the intended send time of the next request (open loop only)
+         * @params:
+         *    - intended: the intended send time in nanoseconds
+         */
+        void schedule(uint64_t intended);
+
+        /**
+         * Send the pending gets to the cache
+         */
+        void flush();
+
+        /**
+         * Parallel replay, executes its queue of each second between two barriers
+         */
+        void run(rd_utils::concurrency::Thread);
+
+    private:
+        friend Generator;
+
+        // waits shorter than this are spent spinning instead of sleeping
+        static constexpr uint64_t SPIN_NS = 50000;
+
+        Generator* _generator;
+
+        // the requests of the current and next seconds routed to this replayer
+        std::vector<line> _queues[2];
+
+        // intended send time of the next request in open loop, 0 in closed loop
+        uint64_t _intended = 0;
+
+        // latencies of the requests executed since the last export, by operation
+        std::array<LatencyHistogram, NB_OPERATIONS> _latencies;
+
+        // pending gets, sent to the cache with a single getMany
+        std::vector<line> _batch;
+        std::vector<uint64_t> _batch_starts;
+        std::vector<facebook::cachelib::LruAllocator::Key> _batch_keys;
+        std::vector<uint8_t> _batch_hits;
+
+        // values written by the puts, only the first valuesize bytes are used
+        std::string _value;
+    };
+
     class Generator {
     public:
         Generator();
@@ -65,30 +119,122 @@ namespace cachecache {
         Generator(Generator&&);
         void operator=(Generator&&);
 
-        void configure(const std::string & traces, int nb_seconds, int frequency, Cachecache* target, Clock* clock, std::shared_ptr<bool> finished);
+        void configure(const std::string & traces, int nb_seconds, int frequency, KEY_MODE key_mode, Cachecache* target, Clock* clock, Metrics* metrics, std::shared_ptr<bool> finished);
         void run(rd_utils::concurrency::Thread);
         void run();
 
+        /**
+         * Send the consecutive gets of a second to the cache by batches of at most size keys
+         */
+        void setBatchSize(unsigned int size);
+
+        /**
+         * Replay the traces with nb threads, the requests of a key are always sent by the same thread
+         */
+        void setWorkers(unsigned int nb);
+
+        /**
+         * Open loop replays always go through the reader stage, to know the number of requests of each second
+         */
+        void setLoop(LOOP loop);
+
+        /**
+         * Stop the replay at the end of the current second, can be called from any thread
+         */
+        void stop();
+
+        /**
+         * Replay the traces as fast as possible, each second ends with a round shared with the other generators
+         * The frequency is ignored, the loop must be closed
+         */
+        void setRounds(Rounds* rounds);
+
     private:
+        friend Replayer;
+
+        /**
+         * Called by the last replay thread reaching the end of a second
+         */
+        struct SecondEnd {
+            Generator* generator;
+            void operator()() noexcept;
+        };
+
         rd_utils::concurrency::timer _timer;
         float _target_time = 1;
 
         std::string _traces;
         int _nb_seconds; 
+        KEY_MODE _key_mode = KEY_MODE::HASH;
         Cachecache* _target;
         Clock* _clock;
+        Metrics* _metrics;
+        // nullptr if the replay is paced by the frequency
+        Rounds* _rounds = nullptr;
 
         std::vector<rd_utils::concurrency::Thread> _threads;
 
+        LOOP _loop = LOOP::CLOSED;
+        // merged latencies of the replayers, exported every second
+        std::array<LatencyHistogram, NB_OPERATIONS> _latencies;
+        // handles of the p50, p99 and p99.9 latencies of each operation
+        std::array<std::array<Metrics::Handle, 3>, NB_OPERATIONS> _latency_metrics;
+
+        unsigned int _batch_size = 1;
+
+        // one replayer in sequential mode, one per worker thread otherwise
+        unsigned int _nb_workers = 1;
+        std::vector<std::unique_ptr<Replayer>> _replayers;
+
+        // synchronizes the reader and the workers at each second of the traces (parallel mode)
+        std::unique_ptr<std::barrier<SecondEnd>> _barrier;
+        // the queues the workers execute during the current second
+        unsigned int _current = 0;
+        // set by the reader before the last barrier
+        std::atomic<bool> _replayed = false;
+        bool _started = false;
+
         std::shared_ptr<bool> _finished;
-        bool _stop = false;
+        // set by the replay, or by stop() from another thread
+        std::atomic<bool> _stop = false;
 
         // metrics
-        int _ignored_lines = 0;
-        int _time = 0;
-
-        void process(std::string&);
-        line parseLine(const std::string &) const;
+        uint64_t _ignored_lines = 0;
+        uint32_t _time = 0;
+
+        /**
+         * Replay the requests of an opened trace reader (csv or binary)
+         */
+        template <typename Reader>
+        void replay(Reader& reader);
+
+        /**
+         * Replay with a reader stage dispatching the requests of each second to the workers
+         */
+        template <typename Reader>
+        void replayParallel(Reader& reader);
+
+        /**
+         * Read the requests of the next second into the next queues of the workers
+         * @returns: false if there is nothing left to replay
+         */
+        template <typename Reader>
+        bool dispatch(Reader& reader, line& pending, bool& has_pending);
+
+        void process(line&);
+
+        /**
+         * Wait for the end of the second, to replay the traces at the configured frequency
+         */
+        void pace();
+
+        /**
+         * Push the p50, p99 and p99.9 of the latencies of the last second to the metrics
+         * Must be called when no replayer is executing requests
+         */
+        void exportLatencies();
+
+        facebook::cachelib::LruAllocator::Key key(const line &) const;
         void dispose();
     
     };
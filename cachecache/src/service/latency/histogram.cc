@@ -0,0 +1,61 @@
+#include "histogram.hh"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cachecache;
+
+LatencyHistogram::LatencyHistogram() {
+    this->_buckets.fill(0);
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+    this->_buckets[index(ns)]++;
+    this->_count++;
+}
+
+uint64_t LatencyHistogram::quantile(double q) const {
+    if (this->_count == 0) return 0;
+
+    uint64_t rank = std::max((uint64_t) 1, (uint64_t) std::ceil(std::clamp(q, 0.0, 1.0) * this->_count));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < NB_BUCKETS; i++) {
+        seen += this->_buckets[i];
+        if (seen >= rank) return upper(i);
+    }
+
+    return MAX_VALUE;
+}
+
+uint64_t LatencyHistogram::count() const {
+    return this->_count;
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (size_t i = 0; i < NB_BUCKETS; i++) {
+        this->_buckets[i] += other._buckets[i];
+    }
+    this->_count += other._count;
+}
+
+void LatencyHistogram::reset() {
+    this->_buckets.fill(0);
+    this->_count = 0;
+}
+
+size_t LatencyHistogram::index(uint64_t ns) {
+    ns = std::min(ns, MAX_VALUE);
+    if (ns < SUB_COUNT) return ns;
+
+    // the position of the highest bit gives the power of two, the next SUB_BITS - 1 bits the linear bucket
+    unsigned int shift = (63 - __builtin_clzll(ns)) - (SUB_BITS - 1);
+    return SUB_COUNT + (shift - 1) * HALF_COUNT + ((ns >> shift) - HALF_COUNT);
+}
+
+uint64_t LatencyHistogram::upper(size_t index) {
+    if (index < SUB_COUNT) return index;
+
+    size_t shift = (index - SUB_COUNT) / HALF_COUNT + 1;
+    uint64_t sub = (index - SUB_COUNT) % HALF_COUNT + HALF_COUNT;
+    return ((sub + 1) << shift) - 1;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace cachecache {
+    /**
+     * Log-linear histogram of latencies in nanoseconds (HDR histogram layout)
+     * Each power of two is split in 64 linear buckets, so quantiles have a relative error below 1/64
+     * A histogram has a single writer, the histograms of several threads are merged to be read
+     */
+    class LatencyHistogram {
+        public:
+            LatencyHistogram();
+
+            void record(uint64_t ns);
+
+            /**
+             * @params:
+             *    - q: the quantile in [0, 1]
+             * @returns: the upper bound of the bucket of the quantile, 0 if nothing was recorded
+             */
+            uint64_t quantile(double q) const;
+
+            uint64_t count() const;
+
+            void merge(const LatencyHistogram& other);
+
+            void reset();
+
+        private:
+            static constexpr unsigned int SUB_BITS = 7;
+            static constexpr uint64_t SUB_COUNT = 1 << SUB_BITS;
+            static constexpr uint64_t HALF_COUNT = SUB_COUNT / 2;
+
+            // latencies are capped to ~18 minutes
+            static constexpr unsigned int MAX_BITS = 40;
+            static constexpr uint64_t MAX_VALUE = (uint64_t(1) << MAX_BITS) - 1;
+            static constexpr size_t NB_BUCKETS = SUB_COUNT + (MAX_BITS - SUB_BITS + 1) * HALF_COUNT;
+
+            std::array<uint64_t, NB_BUCKETS> _buckets;
+            uint64_t _count = 0;
+
+            static size_t index(uint64_t ns);
+            static uint64_t upper(size_t index);
+    };
+}
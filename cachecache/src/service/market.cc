@@ -1,11 +1,16 @@
 #include <service/market.hh>
 #include "cachelib/allocator/memory/Slab.h"
+#include <service/state/state.hh>
 
 
 using namespace cachecache;
 
 Market::Market() {}
 
+Market::~Market() {
+    this->_resizer.stop();
+}
+
 void Market::configure(const MarketConfig& cfg, Metrics* metrics) {
     this->_memory = cfg.memory;
     this->_triggerIncrement = cfg.triggerIncrement;
@@ -13,6 +18,9 @@ void Market::configure(const MarketConfig& cfg, Metrics* metrics) {
     this->_increasingSpeed = cfg.increasingSpeed;
     this->_decreasingSpeed = cfg.decreasingSpeed;
     this->_windowSize = cfg.windowSize;
+    this->_bidding = cfg.bidding;
+    this->_mrcDecay = cfg.mrcDecay;
+    this->_flashValue = cfg.flashValue;
 
     this->_metrics = metrics;
 }
@@ -21,28 +29,101 @@ void Market::register_cache(const std::string& name, Cachecache* cache) {
     XLOG(INFO, "Register new cache for market ", name);
     this->_caches[name] = cache;
     this->_wallets[name] = 0;
+    this->_wallet_metrics[name] = this->_metrics->registerMetric("wallet", {{"client", name}});
+    this->_bought_metrics[name] = this->_metrics->registerMetric("memory_bought", {{"client", name}});
+    this->_stats[name] = std::make_unique<MarketStats>();
+    if (this->_shared == nullptr && !this->_synchronous) {
+        this->_resizer.addCache(name, cache);
+    }
+}
+
+void Market::setSharedAllocator(SharedAllocator* allocator) {
+    this->_shared = allocator;
+}
+
+void Market::setSynchronous() {
+    this->_synchronous = true;
+    this->_resizer.stop();
 }
 
 void Market::unregister_cache(const std::string& name) {
+    this->_resizer.removeCache(name);
     this->_caches.erase(name);
     this->_wallets.erase(name);
+    this->_wallet_metrics.erase(name);
+    this->_bought_metrics.erase(name);
+    this->_stats.erase(name);
+}
+
+bool Market::stop(std::chrono::seconds timeout) {
+    bool res = facebook::cachelib::PeriodicWorker::stop(timeout);
+    this->_resizer.stop();
+    return res;
+}
+
+const MarketStats* Market::getStats(const std::string& name) const {
+    auto fnd = this->_stats.find(name);
+    if (fnd == this->_stats.end()) return nullptr;
+    return fnd->second.get();
+}
+
+void Market::save(std::ostream& out) const {
+    state::write<uint32_t>(out, this->_wallets.size());
+    for (auto & [name, wallet]: this->_wallets) {
+        state::writeString(out, name);
+        state::write<uint64_t>(out, wallet);
+        state::write<uint64_t>(out, this->_stats.at(name)->memory_bought.load());
+    }
+}
+
+bool Market::load(std::istream& in) {
+    uint32_t nb;
+    if (!state::read(in, nb)) return false;
+
+    for (uint32_t i = 0; i < nb; i++) {
+        std::string name;
+        uint64_t wallet, bought;
+        if (!state::readString(in, name) || !state::read(in, wallet) || !state::read(in, bought)) return false;
+
+        // the caches removed from the configuration lose their wallet
+        if (this->_caches.find(name) == this->_caches.end()) continue;
+        this->_wallets[name] = wallet;
+        this->_stats[name]->wallet = wallet;
+        this->_stats[name]->memory_bought = bought;
+    }
+
+    return true;
 }
 
 void Market::work() {
-    auto & caches = this->_caches;
-    for (auto & [name, cache]: caches) {
-        XLOG(INFO, "Cache ", name, " using ", cache->currentMemoryUsage(), " - wallet = ", this->_wallets[name]);
-        this->_metrics->push("wallet", {{"client", name}}, std::to_string(this->_wallets[name]));
+    // every cache is read once, the whole round works on the same state
+    std::unordered_map<std::string, Usage> snapshot;
+    for (auto & [name, cache]: this->_caches) {
+        snapshot[name] = Usage{cache->currentMemoryUsage(), cache->requested(), cache->size(), cache->nvmSize(), {}};
+        if (this->_bidding == BIDDING::UTILITY) {
+            snapshot[name].hits = cache->hitCurve(this->_mrcDecay);
+        }
     }
 
-    // sell what's need to be sold
-    std::unordered_map<std::string, size_t> buyers;
-    size_t market = this->_memory;
+    for (auto & [name, usage]: snapshot) {
+        XLOG(INFO, "Cache ", name, " using ", usage.usage, " - wallet = ", this->_wallets[name]);
+        this->_metrics->push(this->_wallet_metrics[name], this->_wallets[name]);
+        this->_stats[name]->wallet = this->_wallets[name];
+    }
 
-    auto allocated = this->sellBaseMemory(market, buyers);
+    std::unordered_map<std::string, size_t> allocated;
+    if (this->_bidding == BIDDING::UTILITY) {
+        allocated = this->allocateByUtility(snapshot);
+    } else {
+        // sell what's need to be sold
+        std::unordered_map<std::string, size_t> buyers;
+        size_t market = this->_memory;
 
-    size_t allNeeded = 0;
-    this->buyExtraMemory(allocated, buyers, market, allNeeded);
+        allocated = this->sellBaseMemory(snapshot, market, buyers);
+
+        size_t allNeeded = 0;
+        this->buyExtraMemory(allocated, buyers, market, allNeeded);
+    }
 
     /*if (market > 0) {
         size_t notSold = market;
@@ -56,8 +137,31 @@ void Market::work() {
         }
     }*/
 
-    for (auto & [name, amount]: allocated) {
-        this->_caches[name]->resize(amount);
+    if (this->_shared != nullptr) {
+        // moving memory between pools only changes their limits, the pool resizer moves the slabs
+        this->_shared->rebalance(allocated);
+    } else {
+        // a shrink can take long to release its slabs, it must not delay the round nor the other caches
+        // unless the round is in trace time, where the resize must be done in the second it was decided
+        for (auto & [name, amount]: allocated) {
+            if (amount == snapshot[name].size) continue;
+            if (!this->_synchronous) {
+                this->_resizer.submit(name, amount);
+                continue;
+            }
+
+            try {
+                if (!this->_caches[name]->resize(amount)) {
+                    XLOG(ERR, "Could not resize cache ", name, " to ", amount);
+                }
+            } catch (const std::exception& e) {
+                XLOG(ERR, "Could not resize cache ", name, " : ", e.what());
+            }
+        }
+    }
+
+    for (auto & [name, wallet]: this->_wallets) {
+        this->_stats[name]->wallet = wallet;
     }
 }
 
@@ -80,7 +184,8 @@ void Market::buyExtraMemory(std::unordered_map<std::string, size_t> & allocated,
                     this->_wallets[cache->first] = money - bought;
                     buyers[cache->first] -= bought;
                     allocated[cache->first] = allocated[cache->first] + bought;
-                    this->_metrics->push("memory_bought", {{"client", cache->first}}, std::to_string(bought));
+                    this->_metrics->push(this->_bought_metrics[cache->first], bought);
+                    this->_stats[cache->first]->memory_bought += bought;
                     market -= bought;
                     cache++;
                 } else {
@@ -98,16 +203,17 @@ void Market::buyExtraMemory(std::unordered_map<std::string, size_t> & allocated,
 }
 
 
-std::unordered_map<std::string, size_t> Market::sellBaseMemory(size_t & market, 
+std::unordered_map<std::string, size_t> Market::sellBaseMemory(const std::unordered_map<std::string, Usage> & snapshot,
+        size_t & market, 
         std::unordered_map<std::string, size_t> & buyers) {
 
     std::unordered_map<std::string, size_t> allocated;
     size_t max = market;
 
-    for (auto & [name, cache]: this->_caches) {
-        size_t usage = cache->currentMemoryUsage();
-        size_t requested = cache->requested();
-        size_t capp = cache->size();
+    for (auto & [name, state]: snapshot) {
+        size_t usage = state.usage;
+        size_t requested = state.requested;
+        size_t capp = state.size;
 
         if (usage > capp) XLOG(ERR, "OVERUSAGE FOR CACHE ", name, " ", usage , " > ", capp);
 
@@ -133,7 +239,84 @@ std::unordered_map<std::string, size_t> Market::sellBaseMemory(size_t & market,
             this->increaseMoney(name, requested - usage);
         }
 
-        market -= allocated[name]; 
+        market -= std::min(market, allocated[name]);
+    }
+
+    return allocated;
+}
+
+std::unordered_map<std::string, size_t> Market::allocateByUtility(const std::unordered_map<std::string, Usage> & snapshot) {
+    const size_t slab = facebook::cachelib::Slab::kSize;
+    const size_t step = std::max(slab, (this->_windowSize / slab) * slab);
+
+    auto hitsAt = [slab](const Usage& state, size_t size) {
+        if (state.hits.empty()) return 0.0;
+        return state.hits[std::min(size / slab, state.hits.size() - 1)];
+    };
+
+    // with a flash tier, the items that do not fit in memory are still served, at a lower value
+    auto valueAt = [this, &hitsAt](const Usage& state, size_t size) {
+        double memory = hitsAt(state, size);
+        if (state.nvm == 0) return memory;
+        return memory + this->_flashValue * (hitsAt(state, size + state.nvm) - memory);
+    };
+
+    std::unordered_map<std::string, size_t> allocated;
+    size_t market = this->_memory;
+    for (auto & [name, state]: snapshot) {
+        allocated[name] = slab;
+        market -= std::min(market, slab);
+    }
+
+    while (market >= slab) {
+        const std::string* best = nullptr;
+        double bestGain = 0;
+        size_t bestAmount = 0;
+
+        for (auto & [name, state]: snapshot) {
+            size_t current = allocated[name];
+            size_t budget = state.requested + this->_wallets[name];
+            if (current + slab > budget) continue;
+
+            // the bid of a cache is its best gain per byte over the next windows
+            size_t limit = (std::min({budget - current, market, step * LOOKAHEAD}) / slab) * slab;
+            for (size_t amount = std::min(step, limit); amount > 0; amount = std::min(amount + step, limit)) {
+                double gain = (valueAt(state, current + amount) - valueAt(state, current)) / amount;
+                if (gain > bestGain) {
+                    best = &name;
+                    bestGain = gain;
+                    bestAmount = std::min(amount, step);
+                }
+                if (amount == limit) break;
+            }
+        }
+
+        // nobody gains anything from the remaining memory
+        if (best == nullptr) break;
+
+        allocated[*best] += bestAmount;
+        market -= bestAmount;
+    }
+
+    // the memory nobody bid on stays with the caches that requested it
+    for (auto & [name, state]: snapshot) {
+        if (market < slab) break;
+        if (allocated[name] < state.requested) {
+            size_t add = std::min(((state.requested - allocated[name]) / slab) * slab, (market / slab) * slab);
+            allocated[name] += add;
+            market -= add;
+        }
+    }
+
+    for (auto & [name, state]: snapshot) {
+        if (allocated[name] > state.requested) {
+            size_t bought = allocated[name] - state.requested;
+            this->_wallets[name] -= std::min(this->_wallets[name], bought);
+            this->_metrics->push(this->_bought_metrics[name], bought);
+            this->_stats[name]->memory_bought += bought;
+        } else {
+            this->increaseMoney(name, state.requested - allocated[name]);
+        }
     }
 
     return allocated;
@@ -1,14 +1,31 @@
 #pragma once
 
+#include <atomic>
+#include <istream>
+#include <ostream>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <vector>
 #include <cachelib/common/PeriodicWorker.h>
 #include <service/cachecache.hh>
 #include <service/metrics/metrics.hh>
+#include <service/resizer/resizer.hh>
 
 namespace cachecache {
     class Supervisor;
 
+    // how the memory above the requested sizes is shared
+    enum class BIDDING {
+        USAGE // caches filling their memory buy by steps of windowSize, as long as their wallet allows it
+        ,UTILITY // memory goes to the caches gaining the most hits per byte, from their miss ratio curves
+    };
+
+    const std::unordered_map<std::string, BIDDING> STR_TO_BIDDING = {
+        {"usage", BIDDING::USAGE}
+        , {"utility", BIDDING::UTILITY}
+    };
+
     struct MarketConfig {
         /// Global cache size
         size_t memory; 
@@ -26,18 +43,74 @@ namespace cachecache {
         float decreasingSpeed;
 
         size_t windowSize;
+
+        BIDDING bidding = BIDDING::USAGE;
+
+        /// The weight kept by the past hits of the miss ratio curves at each round (utility bidding)
+        double mrcDecay = 0.9;
+
+        /// The value of a hit served by a flash tier, relative to a hit served from memory (utility bidding)
+        double flashValue = 0.5;
     };
 
+    /**
+     * Live state of the account of a cache, read without locking the market
+     */
+    struct MarketStats {
+        std::atomic<size_t> wallet = 0;
+        // memory bought since the start
+        std::atomic<size_t> memory_bought = 0;
+    };
+
+    /**
+     * Periodically shares the memory between the registered caches
+     * Each round works on a snapshot of the usage of every cache, the resizes are applied in the background (unless synchronous)
+     */
     class Market : public facebook::cachelib::PeriodicWorker {
         public:
             Market();
+            ~Market();
             Market(Market &) = delete;
             void operator=(Market &) = delete;
             void configure(const MarketConfig& cfg, Metrics* metrics);
             void register_cache(const std::string& name, Cachecache* cache);
             void unregister_cache(const std::string& name);
+
+            /**
+             * The caches are pools of a shared allocator, the rounds move memory between the pools
+             * Must be set before the caches are registered
+             */
+            void setSharedAllocator(SharedAllocator* allocator);
+
+            /**
+             * Apply the resizes in work() before it returns instead of in the background
+             * Used when the rounds of the replay call work(), the trace second of a resize must not depend on the speed of the machine
+             */
+            void setSynchronous();
             void work(); 
 
+            /**
+             * Stop the rounds, then the resizes still running
+             */
+            bool stop(std::chrono::seconds timeout = std::chrono::seconds(0));
+
+            /**
+             * @returns: the live state of the account of a registered cache, nullptr if there is none
+             * The caches must not be registered or unregistered while the stats are read
+             */
+            const MarketStats* getStats(const std::string& name) const;
+
+            /**
+             * Save the wallets of the caches, the market must be stopped
+             */
+            void save(std::ostream& out) const;
+
+            /**
+             * Restore the wallets of the registered caches, before the market is started
+             * @returns: false if the saved wallets cannot be read
+             */
+            bool load(std::istream& in);
+
         private:
             // CONFIG
             size_t _memory;
@@ -46,6 +119,9 @@ namespace cachecache {
             float _increasingSpeed;
             float _decreasingSpeed;
             size_t _windowSize;
+            BIDDING _bidding;
+            double _mrcDecay;
+            double _flashValue;
 
             Metrics* _metrics;
 
@@ -53,7 +129,33 @@ namespace cachecache {
             // mapping between a cache name and its wallet
             std::unordered_map<std::string, size_t> _wallets;
 
-            std::unordered_map<std::string, size_t> sellBaseMemory(size_t & market, 
+            // mapping between a cache name and the handles of its wallet and memory bought metrics
+            std::unordered_map<std::string, Metrics::Handle> _wallet_metrics;
+            std::unordered_map<std::string, Metrics::Handle> _bought_metrics;
+            std::unordered_map<std::string, std::unique_ptr<MarketStats>> _stats;
+
+            // the state of a cache at the start of a round
+            struct Usage {
+                size_t usage;
+                size_t requested;
+                size_t size;
+                // size of the flash tier, fixed at configuration
+                size_t nvm;
+                // hits[i] = estimated hits with i slabs (utility bidding)
+                std::vector<double> hits;
+            };
+
+            // number of windows a bid looks ahead, the miss ratio curves can have plateaus before a cliff
+            static constexpr size_t LOOKAHEAD = 64;
+
+            Resizer _resizer;
+            // the resizes are applied by work() itself, the resizer is stopped
+            bool _synchronous = false;
+            // nullptr if each cache has its own allocator
+            SharedAllocator* _shared = nullptr;
+
+            std::unordered_map<std::string, size_t> sellBaseMemory(const std::unordered_map<std::string, Usage> & snapshot,
+                    size_t & market, 
                     std::unordered_map<std::string, size_t> & buyers);
 
             void buyExtraMemory(std::unordered_map<std::string, size_t> & allocated, 
@@ -61,5 +163,11 @@ namespace cachecache {
                     size_t & market,
                     size_t & allNeeded);
             void increaseMoney(const std::string& cache, size_t amount);
+
+            /**
+             * Give the memory step by step to the cache that gains the most hits per byte with it
+             * A cache can hold its requested memory plus what its wallet can pay
+             */
+            std::unordered_map<std::string, size_t> allocateByUtility(const std::unordered_map<std::string, Usage> & snapshot);
     };
 }
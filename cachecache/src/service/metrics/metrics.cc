@@ -1,89 +1,173 @@
 #include "metrics.hh"
-#include <sstream>
+
+#include <algorithm>
+#include <charconv>
+#include <thread>
 
 using namespace cachecache;
+using namespace rd_utils::concurrency;
+
+std::atomic<uint64_t> Metrics::NEXT_ID = 1;
+
+Metrics::Metrics():
+    _id(NEXT_ID.fetch_add(1))
+    , _wallclock(CLOCK_SOURCE::REALTIME)
+    , _clock(&_wallclock)
+    , _output_directory("/tmp") {}
 
-Metrics::Metrics(): _output_directory("/tmp") {}
 Metrics::~Metrics() {
-    for(auto &[name, ofs]: this->_ofs) {
-        ofs.close();
+    this->stop();
+    for(auto &[name, output]: this->_outputs) {
+        output->ofs.close();
     }
 }
 
-Metrics::Metrics(Metrics && other):
-    _output_directory(std::move(other._output_directory))
-    , _metrics(std::move(other._metrics))
-    , _ofs(std::move(other._ofs)) {}
-
-void Metrics::operator=(Metrics && other) {
-    this->_output_directory = std::move(other._output_directory);
-    this->_metrics = std::move(other._metrics);
-    this->_ofs = std::move(other._ofs);
+void Metrics::setClock(Clock* clock) {
+    this->_clock = clock;
 }
 
 void Metrics::configure(const std::string & output_directory) {
     this->_output_directory = output_directory;
-}
 
-void Metrics::register_new(const std::string& name, const Labels& labels) { 
-    if (this->_ofs.find(name) != this->_ofs.end()) {
-        XLOG(ERR, "Register existing metric ", name);
-        // throw exception
-        return;
+    if (!this->_running) {
+        this->_running = true;
+        this->_writer = spawn(this, &Metrics::write);
     }
+}
+
+void Metrics::stop() {
+    if (!this->_running) return;
+
+    this->_running = false;
+    join(this->_writer);
+}
 
-   if (this->_metrics.find(name) != this->_metrics.end()) {
-        this->_metrics[name].clear();
-    } else {
-        this->_metrics[name].reserve(labels.size());
+Metrics::Handle Metrics::registerMetric(const std::string& name, const Labels& labels) {
+    std::scoped_lock lock(this->_mutex);
+
+    auto fnd = this->_outputs.find(name);
+    if (fnd == this->_outputs.end()) {
+        auto output = std::make_unique<Output>();
+        for (const auto & [label, value]: labels) {
+            output->labels.push_back(label);
+        }
+
+        output->ofs.open(this->_output_directory + "/" + name + ".csv");
+        output->ofs << "time;" << name;
+        for (const auto & label : output->labels) {
+            output->ofs << ";" << label;
+        }
+        output->ofs << "\n";
+        output->ofs.flush();
+
+        fnd = this->_outputs.emplace(name, std::move(output)).first;
     }
-    for (const auto & [label, value]: labels) {
-        this->_metrics[name].push_back(label);
+
+    Registered registered;
+    registered.output = fnd->second.get();
+    for (const auto & label : registered.output->labels) {
+        auto value = labels.find(label);
+        if (value != labels.end()) {
+            registered.labels += ";" + value->second;
+        }
     }
 
-    std::stringstream ss;
-    ss << this->_output_directory << "/" << name << ".csv";
-    this->_ofs[name].open(ss.str());
+    this->_registered.push_back(std::move(registered));
+    return this->_registered.size() - 1;
+}
 
-    this->_ofs[name] << "time;" << name;
+void Metrics::push(Handle handle, double value) {
+    Ring* ring = this->ring();
 
-    if (this->_metrics[name].size() == 0) {
-        this->_ofs[name] << "\n";
-        return;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    if (head - ring->tail.load(std::memory_order_acquire) >= RING_CAPACITY) {
+        this->drain();
     }
 
-    for (const auto & label : this->_metrics[name]) {
-        this->_ofs[name] << ";" << label;
+    double time = Clock::toSeconds(this->_clock->time());
+    ring->entries[head % RING_CAPACITY] = Entry{time, value, handle};
+    ring->head.store(head + 1, std::memory_order_release);
+}
+
+void Metrics::push(std::span<const Handle> handles, std::span<const double> values) {
+    Ring* ring = this->ring();
+
+    double time = Clock::toSeconds(this->_clock->time());
+    for (size_t i = 0; i < handles.size();) {
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        uint64_t free = RING_CAPACITY - (head - ring->tail.load(std::memory_order_acquire));
+        if (free == 0) {
+            this->drain();
+            continue;
+        }
+
+        // a batch larger than the free space is pushed in several parts, with the same timestamp
+        size_t nb = std::min((size_t) free, handles.size() - i);
+        for (size_t j = 0; j < nb; j++) {
+            ring->entries[(head + j) % RING_CAPACITY] = Entry{time, values[i + j], handles[i + j]};
+        }
+        ring->head.store(head + nb, std::memory_order_release);
+        i += nb;
     }
-    this->_ofs[name] << "\n";
-    this->_ofs[name].flush();
 }
 
-void Metrics::push(const std::string& metric, const Labels& labels, const std::string& value) {
-    if (this->_metrics.find(metric) == this->_metrics.end()) {
+Metrics::Ring* Metrics::ring() {
+    thread_local uint64_t owner = 0;
+    thread_local Ring* ring = nullptr;
+
+    if (owner != this->_id) {
+        // first push of this thread, the ring lives as long as the metrics
         std::scoped_lock lock(this->_mutex);
-        this->register_new(metric, labels); 
+        this->_rings.push_back(std::make_unique<Ring>());
+        ring = this->_rings.back().get();
+        owner = this->_id;
     }
 
-    std::stringstream ss;
-    ss << std::to_string(this->_timer.time_since_start()) << ";" << value;
-    if (this->_metrics[metric].size() == 0) {
-        ss << "\n";
-        return;
+    return ring;
+}
+
+void Metrics::write(Thread) {
+    while (this->_running) {
+        std::this_thread::sleep_for(WRITE_PERIOD);
+        this->drain();
     }
 
-    for (const auto & label : this->_metrics[metric]) {
-        if(labels.count(label)) {
-            ss << ";" << labels.at(label);
+    this->drain();
+}
+
+void Metrics::drain() {
+    std::scoped_lock lock(this->_mutex);
+
+    char number[64];
+    auto format = [&number](std::string& out, double value) {
+        auto res = std::to_chars(number, number + sizeof(number), value);
+        out.append(number, res.ptr - number);
+    };
+
+    for (auto & ring: this->_rings) {
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        uint64_t head = ring->head.load(std::memory_order_acquire);
+
+        for (; tail < head; tail++) {
+            const Entry & entry = ring->entries[tail % RING_CAPACITY];
+            const Registered & registered = this->_registered[entry.handle];
+
+            std::string & buffer = registered.output->buffer;
+            format(buffer, entry.time);
+            buffer += ';';
+            format(buffer, entry.value);
+            buffer += registered.labels;
+            buffer += '\n';
         }
+
+        ring->tail.store(tail, std::memory_order_release);
     }
 
-    ss << "\n";
-    {
-        //XLOG(INFO, "### ", labels.at("client") ," ASKING FOR LOCK.... ");
-        std::scoped_lock lock(this->_mutex);
-        //XLOG(INFO, "### ", labels.at("client") ,"GOT LOCK.... ");
-        this->_ofs[metric] << ss.str();
-        this->_ofs[metric].flush();
+    for (auto & [name, output]: this->_outputs) {
+        if (output->buffer.empty()) continue;
+
+        output->ofs.write(output->buffer.data(), output->buffer.size());
+        output->ofs.flush();
+        output->buffer.clear();
     }
 }
@@ -1,7 +1,12 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <fstream>
 #include <iostream>
+#include <memory>
+#include <span>
 #include <string>
 #include <vector>
 #include <unordered_map>
@@ -9,36 +14,122 @@
 
 #include "folly/logging/xlog.h"
 #include "folly/logging/LogLevel.h"
-#include <rd_utils/concurrency/timer.hh>
+#include <rd_utils/concurrency/thread.hh>
 #include <service/clock/clock.hh>
 
 namespace cachecache {
     // An association between a label category (e.g "Client") and its value (e.g "client_1")
     typedef std::pair<std::string, std::string> Label;
     typedef std::unordered_map<std::string, std::string> Labels;
+
+    /**
+     * Writes the metrics in csv files (one per metric) in the output directory
+     * The metrics are registered once, then pushed from any thread without lock nor allocation:
+     * each thread appends its values to its own ring, drained by a background writer thread (or by the thread itself when full)
+     */
     class Metrics {
         public:
+            // a metric with the values of its labels
+            typedef uint32_t Handle;
+
             Metrics();
             ~Metrics();
 
             Metrics(Metrics &) = delete;
             void operator=(Metrics &) = delete;
-            Metrics(Metrics &&);
-            void operator=(Metrics &&);
 
+            /**
+             * Set the output directory and start the writer thread
+             */
             void configure(const std::string& output_directory);
-            void push(const std::string& metric, const Labels& labels, const std::string& value);
+
+            /**
+             * Timestamp the values with the time of clock instead of the time elapsed since the creation
+             * Must be set before the first push
+             */
+            void setClock(Clock* clock);
+
+            /**
+             * Register a metric (creating its file on first registration) with the values of its labels
+             * A metric can be registered several times with different label values (e.g. one per client)
+             */
+            Handle registerMetric(const std::string& metric, const Labels& labels);
+
+            /**
+             * Push a value of a registered metric, timestamped now
+             * Never drops a value, if the writer thread is too late the pushing thread writes the pending values itself
+             */
+            void push(Handle handle, double value);
+
+            /**
+             * Push values of several metrics with the same timestamp, values[i] being the value of handles[i]
+             */
+            void push(std::span<const Handle> handles, std::span<const double> values);
+
+            /**
+             * Write the pending values and stop the writer thread
+             */
+            void stop();
 
         private:
-            std::mutex _mutex;
-            rd_utils::concurrency::timer _timer;
+            // maximal time a pushed value waits before being written
+            static constexpr std::chrono::milliseconds WRITE_PERIOD = std::chrono::milliseconds(100);
+            // a ring is ~100KB, a full ring is drained by its pushing thread (e.g. replay as fast as possible)
+            static constexpr size_t RING_CAPACITY = 1 << 12;
+
+            struct Entry {
+                double time;
+                double value;
+                Handle handle;
+            };
 
+            /**
+             * Single producer (a pushing thread), single consumer (the writer thread) ring of values
+             */
+            struct Ring {
+                alignas(64) std::atomic<uint64_t> head = 0;
+                alignas(64) std::atomic<uint64_t> tail = 0;
+                std::array<Entry, RING_CAPACITY> entries;
+            };
+
+            struct Output {
+                std::ofstream ofs;
+                // the label names in the order of the columns
+                std::vector<std::string> labels;
+                // the lines waiting to be written
+                std::string buffer;
+            };
+
+            struct Registered {
+                Output* output;
+                // the label columns of the lines, already formatted
+                std::string labels;
+            };
+
+            // identifies the instance in the thread local rings
+            static std::atomic<uint64_t> NEXT_ID;
+            uint64_t _id;
+
+            // timestamps of the values, in seconds since the creation of the metrics by default
+            Clock _wallclock;
+            Clock* _clock;
             std::string _output_directory;
-            // a mapping between a metric name and its associated label names
-            std::unordered_map<std::string, std::vector<std::string>> _metrics;
-            // mapping between a metric name and its output file stream
-            std::unordered_map<std::string, std::ofstream> _ofs;
 
-            void register_new(const std::string& metric, const Labels& labels);
+            // protects the registrations and the list of rings, taken by the writer while draining
+            std::mutex _mutex;
+            std::unordered_map<std::string, std::unique_ptr<Output>> _outputs;
+            std::vector<Registered> _registered;
+            std::vector<std::unique_ptr<Ring>> _rings;
+
+            std::atomic<bool> _running = false;
+            rd_utils::concurrency::Thread _writer;
+
+            Ring* ring();
+            void write(rd_utils::concurrency::Thread);
+
+            /**
+             * Write the values pushed so far
+             */
+            void drain();
     };
 }
@@ -0,0 +1,159 @@
+#include "mrc.hh"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace cachecache;
+
+MissRatioCurve::MissRatioCurve() {}
+
+MissRatioCurve::MissRatioCurve(MissRatioCurve&& other):
+    _threshold(other._threshold.load())
+    , _granularity(other._granularity)
+    , _accesses(std::move(other._accesses))
+    , _fenwick(std::move(other._fenwick))
+    , _position(other._position)
+    , _total_size(other._total_size)
+    , _bins(std::move(other._bins)) {
+
+    other._threshold = 0;
+    other._position = 0;
+    other._total_size = 0;
+}
+
+void MissRatioCurve::operator=(MissRatioCurve&& other) {
+    this->_threshold = other._threshold.load();
+    other._threshold = 0;
+    this->_granularity = other._granularity;
+    this->_accesses = std::move(other._accesses);
+    this->_fenwick = std::move(other._fenwick);
+    this->_position = other._position;
+    other._position = 0;
+    this->_total_size = other._total_size;
+    other._total_size = 0;
+    this->_bins = std::move(other._bins);
+}
+
+void MissRatioCurve::configure(double rate, size_t granularity, size_t max_size) {
+    std::scoped_lock lock(this->_mutex);
+
+    this->_threshold = std::max((uint64_t) 1, (uint64_t) (std::clamp(rate, 0.0, 1.0) * MODULUS));
+    this->_granularity = std::max(granularity, (size_t) 1);
+    this->_bins.assign(max_size / this->_granularity + 2, 0);
+    this->_fenwick.assign(CAPACITY + 1, 0);
+    this->_accesses.clear();
+    this->_position = 0;
+    this->_total_size = 0;
+}
+
+bool MissRatioCurve::enabled() const {
+    return this->_threshold != 0;
+}
+
+void MissRatioCurve::record(uint64_t hash, uint32_t size) {
+    // most of the keys are rejected without any lock
+    if (sample(hash) >= this->_threshold.load(std::memory_order_relaxed)) return;
+
+    std::scoped_lock lock(this->_mutex);
+    uint64_t threshold = this->_threshold;
+    if (sample(hash) >= threshold) return;
+
+    double weight = (double) MODULUS / (double) threshold;
+    auto fnd = this->_accesses.find(hash);
+    if (fnd != this->_accesses.end()) {
+        // the bytes of the distinct items accessed since the last access of the key
+        double distance = (this->prefix(this->_position) - this->prefix(fnd->second.position)) * weight;
+        size_t bin = std::min((size_t) (distance / this->_granularity), this->_bins.size() - 1);
+        this->_bins[bin] += weight;
+
+        if (size == 0) size = fnd->second.size;
+        this->add(fnd->second.position, -(int64_t) fnd->second.size);
+        this->_total_size -= fnd->second.size;
+    } else {
+        this->_bins.back() += weight;
+        if (size == 0 && !this->_accesses.empty()) size = this->_total_size / this->_accesses.size();
+    }
+
+    if (this->_position == CAPACITY) this->compact();
+
+    this->_position++;
+    this->add(this->_position, size);
+    this->_accesses[hash] = Access{this->_position, size};
+    this->_total_size += size;
+
+    if (this->_accesses.size() > MAX_KEYS) this->lowerRate();
+}
+
+std::vector<double> MissRatioCurve::hits() const {
+    std::scoped_lock lock(this->_mutex);
+
+    // an access with a distance in bin i hits in the caches of at least (i + 1) * granularity bytes
+    std::vector<double> res(this->_bins.size(), 0);
+    for (size_t i = 1; i < res.size(); i++) {
+        res[i] = res[i - 1] + this->_bins[i - 1];
+    }
+
+    return res;
+}
+
+size_t MissRatioCurve::getGranularity() const {
+    return this->_granularity;
+}
+
+void MissRatioCurve::decay(double factor) {
+    std::scoped_lock lock(this->_mutex);
+    for (auto & bin: this->_bins) {
+        bin *= factor;
+    }
+}
+
+uint64_t MissRatioCurve::sample(uint64_t hash) {
+    // the keys hashes are remixed, they can be raw trace hashes with weak low bits
+    return (hash * 0x9E3779B97F4A7C15ull) >> (64 - MODULUS_BITS);
+}
+
+void MissRatioCurve::add(uint64_t position, int64_t size) {
+    for (; position < this->_fenwick.size(); position += position & -position) {
+        this->_fenwick[position] += size;
+    }
+}
+
+int64_t MissRatioCurve::prefix(uint64_t position) const {
+    int64_t sum = 0;
+    for (; position > 0; position -= position & -position) {
+        sum += this->_fenwick[position];
+    }
+    return sum;
+}
+
+void MissRatioCurve::compact() {
+    std::vector<std::pair<uint64_t, uint64_t>> order;
+    order.reserve(this->_accesses.size());
+    for (auto & [hash, access]: this->_accesses) {
+        order.emplace_back(access.position, hash);
+    }
+    std::sort(order.begin(), order.end());
+
+    std::fill(this->_fenwick.begin(), this->_fenwick.end(), 0);
+    this->_position = 0;
+    for (auto & [position, hash]: order) {
+        auto & access = this->_accesses[hash];
+        access.position = ++this->_position;
+        this->add(access.position, access.size);
+    }
+}
+
+void MissRatioCurve::lowerRate() {
+    this->_threshold = std::max((uint64_t) 1, this->_threshold.load() / 2);
+
+    for (auto it = this->_accesses.begin(); it != this->_accesses.end(); ) {
+        if (sample(it->first) >= this->_threshold) {
+            this->_total_size -= it->second.size;
+            it = this->_accesses.erase(it);
+        } else {
+            it++;
+        }
+    }
+
+    this->compact();
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// SHARDS impl based on (https://www.usenix.org/conference/fast15/presentation/waldspurger)
+namespace cachecache {
+    /**
+     * Online estimation of the hits a cache would get for any size (its miss ratio curve)
+     * The reuse distances, in bytes of distinct items, are computed exactly on a spatial sample of the keys
+     * and scaled by the sampling rate. The sample is bounded, the rate is lowered when it grows too large
+     */
+    class MissRatioCurve {
+        public:
+            MissRatioCurve();
+
+            MissRatioCurve(const MissRatioCurve&) = delete;
+            void operator=(const MissRatioCurve&) = delete;
+
+            MissRatioCurve(MissRatioCurve&&);
+            void operator=(MissRatioCurve&&);
+
+            /**
+             * @params:
+             *    - rate: the initial fraction of the keys that are sampled, in ]0, 1]
+             *    - granularity: the size step of the curve in bytes
+             *    - max_size: the largest cache size of the curve in bytes
+             */
+            void configure(double rate, size_t granularity, size_t max_size);
+
+            bool enabled() const;
+
+            /**
+             * Record an access on a key
+             * @params:
+             *    - hash: the hash of the key
+             *    - size: the size of the item, 0 if unknown (e.g. on a miss)
+             */
+            void record(uint64_t hash, uint32_t size);
+
+            /**
+             * @returns: hits[i] is the estimated (decayed) number of hits of a cache of i * granularity bytes
+             */
+            std::vector<double> hits() const;
+
+            size_t getGranularity() const;
+
+            /**
+             * Multiply the weight of every access recorded so far by factor in [0, 1]
+             */
+            void decay(double factor);
+
+        private:
+            static constexpr unsigned int MODULUS_BITS = 24;
+            static constexpr uint64_t MODULUS = uint64_t(1) << MODULUS_BITS;
+            // maximal number of sampled keys
+            static constexpr size_t MAX_KEYS = 1 << 16;
+            // positions of the accesses in the fenwick tree before a compaction
+            static constexpr size_t CAPACITY = 2 * MAX_KEYS;
+
+            struct Access {
+                uint64_t position;
+                uint32_t size;
+            };
+
+            mutable std::mutex _mutex;
+
+            // the keys whose sampling hash is below are sampled, only lowered under the lock
+            std::atomic<uint64_t> _threshold = 0;
+            size_t _granularity = 1;
+
+            // last access of each sampled key
+            std::unordered_map<uint64_t, Access> _accesses;
+            // size of the items at the position of their last access
+            std::vector<int64_t> _fenwick;
+            uint64_t _position = 0;
+            // sum of the sizes of the sampled items, for the items of unknown sizes
+            uint64_t _total_size = 0;
+
+            // weighted number of accesses per reuse distance, the last bin counts the larger distances and the first accesses
+            std::vector<double> _bins;
+
+            static uint64_t sample(uint64_t hash);
+
+            void add(uint64_t position, int64_t size);
+            int64_t prefix(uint64_t position) const;
+
+            /**
+             * Renumber the last accesses from 1, and rebuild the fenwick tree
+             */
+            void compact();
+
+            /**
+             * Halve the sampling rate and forget the keys that are not sampled anymore
+             */
+            void lowerRate();
+    };
+}
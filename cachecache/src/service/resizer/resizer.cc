@@ -0,0 +1,89 @@
+#include "resizer.hh"
+
+#include "folly/logging/xlog.h"
+#include "folly/logging/LogLevel.h"
+
+using namespace cachecache;
+using namespace rd_utils::concurrency;
+
+Resizer::Resizer() {}
+
+Resizer::~Resizer() {
+    this->stop();
+}
+
+void Resizer::addCache(const std::string& name, Cachecache* cache) {
+    auto queue = std::make_unique<Queue>();
+    queue->cache = cache;
+    queue->thread = spawn(queue.get(), &Queue::run);
+    this->_queues[name] = std::move(queue);
+}
+
+void Resizer::removeCache(const std::string& name) {
+    auto fnd = this->_queues.find(name);
+    if (fnd == this->_queues.end()) return;
+
+    {
+        std::scoped_lock lock(fnd->second->mutex);
+        fnd->second->stop = true;
+    }
+    fnd->second->cv.notify_one();
+    join(fnd->second->thread);
+
+    this->_queues.erase(fnd);
+}
+
+void Resizer::submit(const std::string& name, size_t size) {
+    auto fnd = this->_queues.find(name);
+    if (fnd == this->_queues.end()) {
+        XLOG(ERR, "Resize of unknown cache ", name);
+        return;
+    }
+
+    auto & queue = *fnd->second;
+    {
+        std::scoped_lock lock(queue.mutex);
+        if (queue.pending) XLOG(INFO, "Resize of ", name, " to ", queue.size, " replaced before it started");
+        queue.pending = true;
+        queue.size = size;
+    }
+    queue.cv.notify_one();
+}
+
+void Resizer::stop() {
+    for (auto & [name, queue]: this->_queues) {
+        {
+            std::scoped_lock lock(queue->mutex);
+            queue->stop = true;
+        }
+        queue->cv.notify_one();
+    }
+
+    for (auto & [name, queue]: this->_queues) {
+        join(queue->thread);
+    }
+
+    this->_queues.clear();
+}
+
+void Resizer::Queue::run(Thread) {
+    while (true) {
+        size_t target;
+        {
+            std::unique_lock lock(this->mutex);
+            this->cv.wait(lock, [this] { return this->pending || this->stop; });
+            if (this->stop) return;
+
+            target = this->size;
+            this->pending = false;
+        }
+
+        try {
+            if (!this->cache->resize(target)) {
+                XLOG(ERR, "Could not resize cache to ", target);
+            }
+        } catch (const std::exception& e) {
+            XLOG(ERR, "Could not resize cache : ", e.what());
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <rd_utils/concurrency/thread.hh>
+#include <service/cachecache.hh>
+
+namespace cachecache {
+    /**
+     * Applies the resizes of the caches in the background, one thread per cache
+     * Only the latest requested size of a cache is applied, a slow shrink never delays the other caches
+     */
+    class Resizer {
+        public:
+            Resizer();
+            ~Resizer();
+
+            Resizer(const Resizer&) = delete;
+            void operator=(const Resizer&) = delete;
+
+            void addCache(const std::string& name, Cachecache* cache);
+            void removeCache(const std::string& name);
+
+            /**
+             * Ask for the resize of a cache, replacing its pending resize if it has not started yet
+             */
+            void submit(const std::string& name, size_t size);
+
+            /**
+             * Stop the threads, the pending resizes are dropped
+             */
+            void stop();
+
+        private:
+            struct Queue {
+                Cachecache* cache;
+                std::mutex mutex;
+                std::condition_variable cv;
+                bool pending = false;
+                size_t size = 0;
+                bool stop = false;
+                rd_utils::concurrency::Thread thread;
+
+                void run(rd_utils::concurrency::Thread);
+            };
+
+            std::unordered_map<std::string, std::unique_ptr<Queue>> _queues;
+    };
+}
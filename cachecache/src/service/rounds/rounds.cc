@@ -0,0 +1,43 @@
+#include "rounds.hh"
+
+#include <algorithm>
+
+#include "folly/logging/xlog.h"
+#include "folly/logging/LogLevel.h"
+
+using namespace cachecache;
+
+Rounds::Rounds() {}
+
+void Rounds::configure(size_t participants) {
+    this->_barrier = std::make_unique<std::barrier<RoundEnd>>(participants, RoundEnd{this});
+}
+
+void Rounds::every(uint64_t period, const std::string& name, std::function<void()> task) {
+    this->_tasks.push_back(Task{std::max(period, (uint64_t) 1), name, std::move(task)});
+}
+
+void Rounds::arrive() {
+    this->_barrier->arrive_and_wait();
+}
+
+void Rounds::leave() {
+    this->_barrier->arrive_and_drop();
+}
+
+uint64_t Rounds::seconds() const {
+    return this->_seconds.load();
+}
+
+void Rounds::RoundEnd::operator()() noexcept {
+    uint64_t seconds = this->rounds->_seconds.fetch_add(1) + 1;
+    for (auto & task: this->rounds->_tasks) {
+        if (seconds % task.period != 0) continue;
+
+        try {
+            task.run();
+        } catch (const std::exception& e) {
+            XLOG(ERR, "Task ", task.name, " failed at second ", seconds, " : ", e.what());
+        }
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <atomic>
+#include <barrier>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace cachecache {
+    /**
+     * Lockstep of the generators replaying their traces as fast as possible
+     * A round ends once every generator has replayed one more second of its traces,
+     * the tasks due at that second then run while the generators wait
+     */
+    class Rounds {
+        public:
+            Rounds();
+
+            Rounds(Rounds&) = delete;
+            void operator=(Rounds&) = delete;
+
+            /**
+             * @params:
+             *    - participants: the number of generators taking part in the rounds
+             */
+            void configure(size_t participants);
+
+            /**
+             * Run task at the end of every period seconds of traces, the tasks run in the order they were added
+             * Must be called before the rounds start
+             */
+            void every(uint64_t period, const std::string& name, std::function<void()> task);
+
+            /**
+             * End of a second of traces of a generator, returns when the round is over
+             */
+            void arrive();
+
+            /**
+             * End of the traces of a generator, the next rounds go on without it
+             */
+            void leave();
+
+            /**
+             * @returns: the number of finished rounds, i.e. the number of seconds of traces replayed by every generator
+             */
+            uint64_t seconds() const;
+
+        private:
+            struct Task {
+                uint64_t period;
+                std::string name;
+                std::function<void()> run;
+            };
+
+            /**
+             * Called by the last generator reaching the end of a round
+             */
+            struct RoundEnd {
+                Rounds* rounds;
+                void operator()() noexcept;
+            };
+
+            std::unique_ptr<std::barrier<RoundEnd>> _barrier;
+            std::vector<Task> _tasks;
+            std::atomic<uint64_t> _seconds = 0;
+    };
+}
@@ -0,0 +1,604 @@
+#include "connection.hh"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <endian.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <ctime>
+#include <unistd.h>
+
+#include "folly/logging/xlog.h"
+#include "folly/logging/LogLevel.h"
+
+using namespace cachecache;
+
+using CacheKey = facebook::cachelib::LruAllocator::Key;
+
+template <typename T>
+static bool parseNumber(std::string_view token, T& value) {
+    auto res = std::from_chars(token.data(), token.data() + token.size(), value);
+    return res.ec == std::errc() && res.ptr == token.data() + token.size();
+}
+
+// exptimes above are absolute unix times, as in memcached
+static constexpr int64_t MAX_RELATIVE_EXPTIME = 60 * 60 * 24 * 30;
+
+/**
+ * Convert a memcached exptime to a time to live in seconds, 0 if the item never expires
+ * @returns: false if the item is already expired
+ */
+static bool toTTL(int64_t exptime, uint32_t& ttl) {
+    if (exptime > MAX_RELATIVE_EXPTIME) exptime -= std::time(nullptr);
+    else if (exptime == 0) {
+        ttl = 0;
+        return true;
+    }
+
+    if (exptime <= 0) return false;
+    ttl = (uint32_t) std::min<int64_t>(exptime, UINT32_MAX);
+    return true;
+}
+
+static void appendNumber(std::string& out, uint64_t value) {
+    char buffer[24];
+    auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, res.ptr - buffer);
+}
+
+Connection::Connection(int fd, Cachecache* tenant, const Router* router):
+    _fd(fd)
+    , _tenant(tenant)
+    , _router(router) {}
+
+Connection::~Connection() {
+    close(this->_fd);
+}
+
+bool Connection::onReadable() {
+    bool eof = false;
+    while (true) {
+        size_t size = this->_in.size();
+        this->_in.resize(size + READ_SIZE);
+        ssize_t n = read(this->_fd, this->_in.data() + size, READ_SIZE);
+        this->_in.resize(size + std::max(n, (ssize_t) 0));
+
+        if (n > 0) {
+            if ((size_t) n < READ_SIZE) break;
+            continue;
+        }
+        if (n == 0) {
+            eof = true;
+            break;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+        return false;
+    }
+
+    this->execute();
+    if (!this->flush() || eof) return false;
+
+    // a quit closes the connection once its previous responses are sent
+    return !(this->_closing && !this->hasPendingOutput());
+}
+
+bool Connection::onWritable() {
+    if (!this->flush()) return false;
+    return !(this->_closing && !this->hasPendingOutput());
+}
+
+bool Connection::hasPendingOutput() const {
+    return this->_out_start < this->_out.size();
+}
+
+void Connection::execute() {
+    while (!this->_closing && this->_in_start < this->_in.size()) {
+        std::string_view in(this->_in.data() + this->_in_start, this->_in.size() - this->_in_start);
+
+        size_t consumed = (uint8_t) in[0] == binary::REQUEST ? this->executeBinary(in) : this->executeText(in);
+        if (consumed == 0) break;
+
+        this->_in_start += consumed;
+    }
+
+    if (this->_in_start == this->_in.size()) {
+        this->_in.clear();
+        this->_in_start = 0;
+    } else if (this->_in_start >= READ_SIZE) {
+        this->_in.erase(0, this->_in_start);
+        this->_in_start = 0;
+    }
+}
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================          TEXT           ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+size_t Connection::executeText(std::string_view in) {
+    auto eol = in.find('\n');
+    if (eol == std::string_view::npos) {
+        if (in.size() > MAX_LINE) {
+            this->reply("CLIENT_ERROR line too long");
+            this->_closing = true;
+            return in.size();
+        }
+        return 0;
+    }
+
+    std::string_view line = in.substr(0, eol);
+    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+
+    this->_tokens.clear();
+    size_t pos = 0;
+    while (pos < line.size()) {
+        auto start = line.find_first_not_of(' ', pos);
+        if (start == std::string_view::npos) break;
+
+        auto end = line.find(' ', start);
+        if (end == std::string_view::npos) end = line.size();
+
+        this->_tokens.push_back(line.substr(start, end - start));
+        pos = end;
+    }
+
+    if (this->_tokens.empty()) {
+        this->reply("ERROR");
+        return eol + 1;
+    }
+
+    auto command = this->_tokens[0];
+    if (command == "get") {
+        this->textGet(false);
+    } else if (command == "gets") {
+        this->textGet(true);
+    } else if (command == "set" || command == "add" || command == "replace"
+               || command == "append" || command == "prepend" || command == "cas") {
+        return this->textStore(in, eol + 1);
+    } else if (command == "delete") {
+        this->textDelete();
+    } else if (command == "incr" || command == "decr") {
+        this->textArithmetic(command == "incr");
+    } else if (command == "version") {
+        this->reply("VERSION cachecache");
+    } else if (command == "verbosity") {
+        if (this->_tokens.back() != "noreply") this->reply("OK");
+    } else if (command == "quit") {
+        this->_closing = true;
+    } else {
+        this->reply("ERROR");
+    }
+
+    return eol + 1;
+}
+
+void Connection::textGet(bool with_cas) {
+    // get <key>*
+    for (size_t i = 1; i < this->_tokens.size(); i++) {
+        std::string_view key = this->_tokens[i];
+        auto cache = this->route(key);
+
+        uint32_t flags = 0;
+        uint64_t cas = 0;
+        if (cache == nullptr || !cache->get(CacheKey{key.data(), key.size()}, this->_value, flags, cas)) continue;
+
+        this->_out.append("VALUE ");
+        this->_out.append(this->_tokens[i]);
+        this->_out.push_back(' ');
+        appendNumber(this->_out, flags);
+        this->_out.push_back(' ');
+        appendNumber(this->_out, this->_value.size());
+        if (with_cas) {
+            this->_out.push_back(' ');
+            appendNumber(this->_out, cas);
+        }
+        this->_out.append("\r\n");
+        this->_out.append(this->_value);
+        this->_out.append("\r\n");
+    }
+
+    this->_out.append("END\r\n");
+}
+
+size_t Connection::textStore(std::string_view in, size_t header_size) {
+    // <command> <key> <flags> <exptime> <bytes> [<cas unique>] [noreply]\r\n<data>\r\n
+    auto command = this->_tokens[0];
+    bool is_cas = command == "cas";
+    size_t nb_args = is_cas ? 6 : 5;
+    if (this->_tokens.size() < nb_args) {
+        this->reply("ERROR");
+        return header_size;
+    }
+
+    uint32_t flags;
+    int64_t exptime;
+    size_t bytes;
+    uint64_t cas = 0;
+    if (!parseNumber(this->_tokens[2], flags) || !parseNumber(this->_tokens[3], exptime) || !parseNumber(this->_tokens[4], bytes)
+        || (is_cas && !parseNumber(this->_tokens[5], cas))) {
+        this->reply("CLIENT_ERROR bad command line format");
+        return header_size;
+    }
+
+    if (bytes > Cachecache::MAX_VALUE_SIZE) {
+        // the data block cannot be skipped safely without reading it, the connection is closed
+        this->reply("SERVER_ERROR object too large for cache");
+        this->_closing = true;
+        return in.size();
+    }
+
+    if (in.size() < header_size + bytes + 2) return 0;
+
+    bool noreply = this->_tokens.size() > nb_args && this->_tokens[nb_args] == "noreply";
+    if (in.substr(header_size + bytes, 2) != "\r\n") {
+        this->reply("CLIENT_ERROR bad data chunk");
+        return header_size + bytes + 2;
+    }
+
+    std::string_view data = in.substr(header_size, bytes);
+    std::string_view key = this->_tokens[1];
+    auto cache = this->route(key);
+
+    uint32_t ttl = 0;
+    bool expired = !toTTL(exptime, ttl);
+    CacheKey cache_key{key.data(), key.size()};
+
+    std::string_view result;
+    if (cache == nullptr || key.size() > MAX_KEY) {
+        result = "CLIENT_ERROR bad key";
+    } else if (command == "append" || command == "prepend") {
+        // the item keeps its flags and exptime
+        switch (command == "append" ? cache->append(cache_key, data) : cache->prepend(cache_key, data)) {
+            case STORE_RESULT::STORED: result = "STORED"; break;
+            case STORE_RESULT::TOO_LARGE: result = "SERVER_ERROR object too large for cache"; break;
+            default: result = "NOT_STORED";
+        }
+    } else {
+        if (command == "set") {
+            result = cache->put(cache_key, data, flags, ttl) ? "STORED" : "NOT_STORED";
+        } else if (command == "add") {
+            result = cache->add(cache_key, data, flags, ttl) ? "STORED" : "NOT_STORED";
+        } else if (command == "replace") {
+            result = cache->replace(cache_key, data, flags, ttl) ? "STORED" : "NOT_STORED";
+        } else {
+            switch (cache->cas(cache_key, data, flags, ttl, cas)) {
+                case STORE_RESULT::STORED: result = "STORED"; break;
+                case STORE_RESULT::EXISTS: result = "EXISTS"; break;
+                case STORE_RESULT::NOT_FOUND: result = "NOT_FOUND"; break;
+                default: result = "NOT_STORED";
+            }
+        }
+
+        // stored and expired right away, the previous value is gone
+        if (expired && result == "STORED") cache->remove(cache_key);
+    }
+
+    if (!noreply) this->reply(result);
+    return header_size + bytes + 2;
+}
+
+void Connection::textDelete() {
+    // delete <key> [noreply]
+    if (this->_tokens.size() < 2) {
+        this->reply("ERROR");
+        return;
+    }
+
+    bool noreply = this->_tokens.back() == "noreply";
+    std::string_view key = this->_tokens[1];
+    auto cache = this->route(key);
+
+    std::string_view result;
+    if (cache == nullptr || key.size() > MAX_KEY) {
+        result = "CLIENT_ERROR bad key";
+    } else {
+        result = cache->remove(CacheKey{key.data(), key.size()}) ? "DELETED" : "NOT_FOUND";
+    }
+
+    if (!noreply) this->reply(result);
+}
+
+void Connection::textArithmetic(bool increment) {
+    // incr|decr <key> <value> [noreply]
+    if (this->_tokens.size() < 3) {
+        this->reply("ERROR");
+        return;
+    }
+
+    bool noreply = this->_tokens.size() > 3 && this->_tokens[3] == "noreply";
+    uint64_t delta;
+    if (!parseNumber(this->_tokens[2], delta)) {
+        this->reply("CLIENT_ERROR invalid numeric delta argument");
+        return;
+    }
+
+    std::string_view key = this->_tokens[1];
+    auto cache = this->route(key);
+    if (cache == nullptr || key.size() > MAX_KEY) {
+        if (!noreply) this->reply("CLIENT_ERROR bad key");
+        return;
+    }
+
+    uint64_t value = 0;
+    CacheKey cache_key{key.data(), key.size()};
+    auto res = increment ? cache->incr(cache_key, delta, value) : cache->decr(cache_key, delta, value);
+    if (noreply) return;
+
+    switch (res) {
+        case STORE_RESULT::STORED:
+            appendNumber(this->_out, value);
+            this->_out.append("\r\n");
+            break;
+        case STORE_RESULT::NOT_FOUND:
+            this->reply("NOT_FOUND");
+            break;
+        case STORE_RESULT::NON_NUMERIC:
+            this->reply("CLIENT_ERROR cannot increment or decrement non-numeric value");
+            break;
+        default:
+            this->reply("SERVER_ERROR out of memory");
+    }
+}
+
+void Connection::reply(std::string_view line) {
+    this->_out.append(line);
+    this->_out.append("\r\n");
+}
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================         BINARY          ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+size_t Connection::executeBinary(std::string_view in) {
+    if (in.size() < sizeof(binary::Header)) return 0;
+
+    binary::Header request;
+    std::memcpy(&request, in.data(), sizeof(request));
+    request.keylen = be16toh(request.keylen);
+    request.bodylen = be32toh(request.bodylen);
+    request.cas = be64toh(request.cas);
+
+    if (request.bodylen > Cachecache::MAX_VALUE_SIZE + MAX_KEY + 64) {
+        this->binaryReply(request, binary::VALUE_TOO_LARGE, "", "", "Too large");
+        this->_closing = true;
+        return in.size();
+    }
+
+    size_t total = sizeof(binary::Header) + request.bodylen;
+    if (in.size() < total) return 0;
+
+    if ((size_t) request.extlen + request.keylen > request.bodylen || request.keylen > MAX_KEY) {
+        this->binaryReply(request, binary::INVALID_ARGUMENTS, "", "", "Invalid arguments");
+        return total;
+    }
+
+    std::string_view body = in.substr(sizeof(binary::Header), request.bodylen);
+    std::string_view extras = body.substr(0, request.extlen);
+    std::string_view key = body.substr(request.extlen, request.keylen);
+    std::string_view value = body.substr(request.extlen + request.keylen);
+
+    std::string_view routed = key;
+    switch (request.opcode) {
+        case binary::GET:
+        case binary::GETQ:
+        case binary::GETK:
+        case binary::GETKQ: {
+            bool quiet = request.opcode == binary::GETQ || request.opcode == binary::GETKQ;
+            bool with_key = request.opcode == binary::GETK || request.opcode == binary::GETKQ;
+            auto cache = this->route(routed);
+
+            uint32_t flags = 0;
+            uint64_t cas = 0;
+            if (cache != nullptr && cache->get(CacheKey{routed.data(), routed.size()}, this->_value, flags, cas)) {
+                flags = htobe32(flags);
+                this->binaryReply(request, binary::OK, std::string_view(reinterpret_cast<char*>(&flags), sizeof(flags)), with_key ? key : "", this->_value, cas);
+            } else if (!quiet) {
+                this->binaryReply(request, binary::KEY_NOT_FOUND, "", with_key ? key : "", "Not found");
+            }
+        } break;
+
+        case binary::SET:
+        case binary::SETQ:
+        case binary::ADD:
+        case binary::ADDQ:
+        case binary::REPLACE:
+        case binary::REPLACEQ: {
+            // extras: flags (4 bytes), expiration (4 bytes), a non zero cas in the header makes a set or replace a cas
+            bool quiet = request.opcode == binary::SETQ || request.opcode == binary::ADDQ || request.opcode == binary::REPLACEQ;
+            bool is_add = request.opcode == binary::ADD || request.opcode == binary::ADDQ;
+            bool is_replace = request.opcode == binary::REPLACE || request.opcode == binary::REPLACEQ;
+            auto cache = this->route(routed);
+            if (extras.size() != 8 || cache == nullptr) {
+                this->binaryReply(request, binary::INVALID_ARGUMENTS, "", "", "Invalid arguments");
+                break;
+            }
+
+            uint32_t flags, exptime;
+            std::memcpy(&flags, extras.data(), sizeof(flags));
+            std::memcpy(&exptime, extras.data() + sizeof(flags), sizeof(exptime));
+            flags = be32toh(flags);
+            exptime = be32toh(exptime);
+
+            CacheKey cache_key{routed.data(), routed.size()};
+            uint32_t ttl = 0;
+            bool expired = !toTTL(exptime, ttl);
+
+            uint16_t status;
+            if (!is_add && request.cas != 0) {
+                switch (cache->cas(cache_key, value, flags, ttl, request.cas)) {
+                    case STORE_RESULT::STORED: status = binary::OK; break;
+                    case STORE_RESULT::EXISTS: status = binary::KEY_EXISTS; break;
+                    case STORE_RESULT::NOT_FOUND: status = binary::KEY_NOT_FOUND; break;
+                    default: status = binary::NOT_STORED;
+                }
+            } else if (is_add) {
+                status = cache->add(cache_key, value, flags, ttl) ? binary::OK : binary::KEY_EXISTS;
+            } else if (is_replace) {
+                status = cache->replace(cache_key, value, flags, ttl) ? binary::OK : binary::KEY_NOT_FOUND;
+            } else {
+                status = cache->put(cache_key, value, flags, ttl) ? binary::OK : binary::NOT_STORED;
+            }
+
+            // stored and expired right away, the previous value is gone
+            if (expired && status == binary::OK) cache->remove(cache_key);
+            if (!quiet || status != binary::OK) this->binaryReply(request, status, "", "", "", status == binary::OK ? cache->version(cache_key) : 0);
+        } break;
+
+        case binary::APPEND:
+        case binary::APPENDQ:
+        case binary::PREPEND:
+        case binary::PREPENDQ: {
+            bool quiet = request.opcode == binary::APPENDQ || request.opcode == binary::PREPENDQ;
+            bool is_append = request.opcode == binary::APPEND || request.opcode == binary::APPENDQ;
+            auto cache = this->route(routed);
+            if (!extras.empty() || cache == nullptr) {
+                this->binaryReply(request, binary::INVALID_ARGUMENTS, "", "", "Invalid arguments");
+                break;
+            }
+
+            CacheKey cache_key{routed.data(), routed.size()};
+            uint16_t status;
+            switch (is_append ? cache->append(cache_key, value) : cache->prepend(cache_key, value)) {
+                case STORE_RESULT::STORED: status = binary::OK; break;
+                case STORE_RESULT::TOO_LARGE: status = binary::VALUE_TOO_LARGE; break;
+                default: status = binary::NOT_STORED;
+            }
+            if (!quiet || status != binary::OK) this->binaryReply(request, status, "", "", "", status == binary::OK ? cache->version(cache_key) : 0);
+        } break;
+
+        case binary::INCREMENT:
+        case binary::INCREMENTQ:
+        case binary::DECREMENT:
+        case binary::DECREMENTQ: {
+            // extras: delta (8 bytes), initial value (8 bytes), expiration (4 bytes), 0xffffffff if the key must exist
+            bool quiet = request.opcode == binary::INCREMENTQ || request.opcode == binary::DECREMENTQ;
+            bool increment = request.opcode == binary::INCREMENT || request.opcode == binary::INCREMENTQ;
+            auto cache = this->route(routed);
+            if (extras.size() != 20 || cache == nullptr) {
+                this->binaryReply(request, binary::INVALID_ARGUMENTS, "", "", "Invalid arguments");
+                break;
+            }
+
+            uint64_t delta, initial;
+            uint32_t exptime;
+            std::memcpy(&delta, extras.data(), sizeof(delta));
+            std::memcpy(&initial, extras.data() + 8, sizeof(initial));
+            std::memcpy(&exptime, extras.data() + 16, sizeof(exptime));
+            delta = be64toh(delta);
+            initial = be64toh(initial);
+            exptime = be32toh(exptime);
+
+            CacheKey cache_key{routed.data(), routed.size()};
+            uint64_t result = 0;
+            auto res = increment ? cache->incr(cache_key, delta, result) : cache->decr(cache_key, delta, result);
+            uint32_t ttl = 0;
+            if (res == STORE_RESULT::NOT_FOUND && exptime != 0xffffffff && toTTL(exptime, ttl)) {
+                char digits[24];
+                auto end = std::to_chars(digits, digits + sizeof(digits), initial).ptr;
+                result = initial;
+                res = cache->add(cache_key, std::string_view(digits, end - digits), 0, ttl) ? STORE_RESULT::STORED : STORE_RESULT::NOT_STORED;
+            }
+
+            uint16_t status;
+            switch (res) {
+                case STORE_RESULT::STORED: status = binary::OK; break;
+                case STORE_RESULT::NOT_FOUND: status = binary::KEY_NOT_FOUND; break;
+                case STORE_RESULT::NON_NUMERIC: status = binary::NON_NUMERIC; break;
+                default: status = binary::NOT_STORED;
+            }
+
+            if (status == binary::OK) {
+                if (!quiet) {
+                    result = htobe64(result);
+                    this->binaryReply(request, status, "", "", std::string_view(reinterpret_cast<char*>(&result), sizeof(result)), cache->version(cache_key));
+                }
+            } else {
+                this->binaryReply(request, status, "", "", "");
+            }
+        } break;
+
+        case binary::DELETE:
+        case binary::DELETEQ: {
+            bool quiet = request.opcode == binary::DELETEQ;
+            auto cache = this->route(routed);
+            bool removed = cache != nullptr && cache->remove(CacheKey{routed.data(), routed.size()});
+            if (!quiet || !removed) this->binaryReply(request, removed ? binary::OK : binary::KEY_NOT_FOUND, "", "", removed ? "" : "Not found");
+        } break;
+
+        case binary::NOOP:
+            this->binaryReply(request, binary::OK, "", "", "");
+            break;
+
+        case binary::VERSION:
+            this->binaryReply(request, binary::OK, "", "", "cachecache");
+            break;
+
+        case binary::QUIT:
+        case binary::QUITQ:
+            if (request.opcode == binary::QUIT) this->binaryReply(request, binary::OK, "", "", "");
+            this->_closing = true;
+            break;
+
+        default:
+            this->binaryReply(request, binary::UNKNOWN_COMMAND, "", "", "Unknown command");
+    }
+
+    return total;
+}
+
+void Connection::binaryReply(const binary::Header& request, uint16_t status, std::string_view extras, std::string_view key, std::string_view value, uint64_t cas) {
+    binary::Header response;
+    response.magic = binary::RESPONSE;
+    response.opcode = request.opcode;
+    response.keylen = htobe16(key.size());
+    response.extlen = extras.size();
+    response.datatype = 0;
+    response.status = htobe16(status);
+    response.bodylen = htobe32(extras.size() + key.size() + value.size());
+    response.opaque = request.opaque;
+    response.cas = htobe64(cas);
+
+    this->_out.append(reinterpret_cast<const char*>(&response), sizeof(response));
+    this->_out.append(extras);
+    this->_out.append(key);
+    this->_out.append(value);
+}
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================          UTILS          ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+Cachecache* Connection::route(std::string_view& key) const {
+    return this->_router->route(this->_tenant, key);
+}
+
+bool Connection::flush() {
+    while (this->_out_start < this->_out.size()) {
+        ssize_t n = send(this->_fd, this->_out.data() + this->_out_start, this->_out.size() - this->_out_start, MSG_NOSIGNAL);
+        if (n > 0) {
+            this->_out_start += n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        return false;
+    }
+
+    this->_out.clear();
+    this->_out_start = 0;
+    return true;
+}
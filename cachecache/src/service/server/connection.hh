@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <service/cachecache.hh>
+#include <service/server/router.hh>
+
+// memcached protocols (https://github.com/memcached/memcached/blob/master/doc/protocol.txt)
+// and (https://github.com/memcached/memcached/wiki/BinaryProtocolRevamped)
+namespace cachecache {
+    namespace binary {
+        const uint8_t REQUEST = 0x80;
+        const uint8_t RESPONSE = 0x81;
+
+        enum OPCODE : uint8_t {
+            GET = 0x00
+            ,SET = 0x01
+            ,ADD = 0x02
+            ,REPLACE = 0x03
+            ,DELETE = 0x04
+            ,INCREMENT = 0x05
+            ,DECREMENT = 0x06
+            ,QUIT = 0x07
+            ,GETQ = 0x09
+            ,NOOP = 0x0a
+            ,VERSION = 0x0b
+            ,GETK = 0x0c
+            ,GETKQ = 0x0d
+            ,APPEND = 0x0e
+            ,PREPEND = 0x0f
+            ,SETQ = 0x11
+            ,ADDQ = 0x12
+            ,REPLACEQ = 0x13
+            ,DELETEQ = 0x14
+            ,INCREMENTQ = 0x15
+            ,DECREMENTQ = 0x16
+            ,QUITQ = 0x17
+            ,APPENDQ = 0x19
+            ,PREPENDQ = 0x1a
+        };
+
+        enum STATUS : uint16_t {
+            OK = 0x0000
+            ,KEY_NOT_FOUND = 0x0001
+            ,KEY_EXISTS = 0x0002
+            ,VALUE_TOO_LARGE = 0x0003
+            ,INVALID_ARGUMENTS = 0x0004
+            ,NOT_STORED = 0x0005
+            ,NON_NUMERIC = 0x0006
+            ,UNKNOWN_COMMAND = 0x0081
+            ,OUT_OF_MEMORY = 0x0082
+        };
+
+        struct __attribute__((packed)) Header {
+            uint8_t magic;
+            uint8_t opcode;
+            uint16_t keylen;
+            uint8_t extlen;
+            uint8_t datatype;
+            uint16_t status; // vbucket id in requests
+            uint32_t bodylen;
+            uint32_t opaque;
+            uint64_t cas;
+        };
+    }
+
+    /**
+     * A client connection of the memcached server, speaking the text or the binary protocol
+     * The requests are executed as soon as they are complete, pipelined requests are answered in order
+     */
+    class Connection {
+        public:
+            Connection(int fd, Cachecache* tenant, const Router* router);
+            ~Connection();
+
+            Connection(const Connection&) = delete;
+            void operator=(const Connection&) = delete;
+
+            /**
+             * Read the available bytes, execute the complete requests and send the responses
+             * @returns: false if the connection has to be closed
+             */
+            bool onReadable();
+
+            /**
+             * Send the responses that could not be sent yet
+             * @returns: false if the connection has to be closed
+             */
+            bool onWritable();
+
+            bool hasPendingOutput() const;
+
+        private:
+            static constexpr size_t READ_SIZE = 16384;
+            static constexpr size_t MAX_LINE = 2048;
+            static constexpr size_t MAX_KEY = 250;
+
+            int _fd;
+            // the cache of the port the client connected to, nullptr if routed by key prefix
+            Cachecache* _tenant;
+            const Router* _router;
+
+            std::string _in;
+            size_t _in_start = 0;
+            std::string _out;
+            size_t _out_start = 0;
+            bool _closing = false;
+
+            // buffers reused between the requests
+            std::vector<std::string_view> _tokens;
+            std::string _value;
+
+            void execute();
+
+            // @returns: the number of bytes consumed, 0 if the request is not complete
+            size_t executeText(std::string_view in);
+            size_t executeBinary(std::string_view in);
+
+            void textGet(bool with_cas);
+            size_t textStore(std::string_view in, size_t header_size);
+            void textDelete();
+            void textArithmetic(bool increment);
+
+            void reply(std::string_view line);
+            void binaryReply(const binary::Header& request, uint16_t status, std::string_view extras, std::string_view key, std::string_view value, uint64_t cas = 0);
+
+            Cachecache* route(std::string_view& key) const;
+
+            bool flush();
+    };
+}
@@ -0,0 +1,31 @@
+#include "router.hh"
+
+using namespace cachecache;
+
+Router::Router() {}
+
+void Router::addPort(int port, Cachecache* cache) {
+    this->_ports[port] = cache;
+}
+
+void Router::addCache(const std::string& name, Cachecache* cache) {
+    auto [it, inserted] = this->_names.insert_or_assign(name, cache);
+    this->_caches[std::string_view(it->first)] = cache;
+}
+
+Cachecache* Router::route(Cachecache* tenant, std::string_view& key) const {
+    if (tenant != nullptr) return tenant;
+
+    auto separator = key.find(PREFIX_SEPARATOR);
+    if (separator == std::string_view::npos) return nullptr;
+
+    auto fnd = this->_caches.find(key.substr(0, separator));
+    if (fnd == this->_caches.end()) return nullptr;
+
+    key.remove_prefix(separator + 1);
+    return fnd->second;
+}
+
+const std::unordered_map<int, Cachecache*>& Router::getPorts() const {
+    return this->_ports;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include <service/cachecache.hh>
+
+namespace cachecache {
+    /**
+     * Routes the requests of the memcached clients to the caches
+     * A port is either dedicated to one cache, or shared and the cache is given by the prefix of the keys ("<cache name>:<key>")
+     */
+    class Router {
+        public:
+            Router();
+
+            /**
+             * @params:
+             *    - cache: the cache served on port, nullptr to route by key prefix
+             */
+            void addPort(int port, Cachecache* cache);
+            void addCache(const std::string& name, Cachecache* cache);
+
+            /**
+             * @params:
+             *    - tenant: the cache of the port the request came from (nullptr on shared ports)
+             *    - key: the key of the request, its prefix is removed when routed by prefix
+             * @returns: the cache targeted by the request, nullptr if there is none
+             */
+            Cachecache* route(Cachecache* tenant, std::string_view& key) const;
+
+            const std::unordered_map<int, Cachecache*>& getPorts() const;
+
+            static constexpr char PREFIX_SEPARATOR = ':';
+
+        private:
+            std::unordered_map<int, Cachecache*> _ports;
+            std::unordered_map<std::string_view, Cachecache*> _caches;
+            // owns the names viewed by _caches
+            std::unordered_map<std::string, Cachecache*> _names;
+    };
+}
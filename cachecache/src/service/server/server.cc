@@ -0,0 +1,223 @@
+#include "server.hh"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <stdexcept>
+#include <thread>
+
+#include "folly/logging/xlog.h"
+#include "folly/logging/LogLevel.h"
+
+using namespace cachecache;
+using namespace rd_utils::concurrency;
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================         REACTOR         ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+Reactor::Reactor() {}
+
+Reactor::~Reactor() {
+    this->_connections.clear();
+    for (auto & [fd, cache]: this->_listeners) {
+        ::close(fd);
+    }
+    if (this->_wakeup >= 0) ::close(this->_wakeup);
+    if (this->_epoll >= 0) ::close(this->_epoll);
+}
+
+void Reactor::configure(const std::string& address, const Router* router) {
+    this->_router = router;
+
+    this->_epoll = epoll_create1(EPOLL_CLOEXEC);
+    if (this->_epoll < 0) throw std::runtime_error(std::string("epoll_create1: ") + strerror(errno));
+
+    this->_wakeup = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (this->_wakeup < 0) throw std::runtime_error(std::string("eventfd: ") + strerror(errno));
+    this->watch(this->_wakeup, false);
+
+    for (auto & [port, cache]: router->getPorts()) {
+        int fd = this->listen(address, port);
+        this->_listeners[fd] = cache;
+        this->watch(fd, false);
+    }
+}
+
+void Reactor::run(Thread) {
+    this->run();
+}
+
+void Reactor::run() {
+    epoll_event events[MAX_EVENTS];
+    while (!this->_stop) {
+        int n = epoll_wait(this->_epoll, events, MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            XLOG(ERR, "epoll_wait failed: ", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == this->_wakeup) continue;
+
+            if (this->_listeners.find(fd) != this->_listeners.end()) {
+                this->accept(fd);
+                continue;
+            }
+
+            auto fnd = this->_connections.find(fd);
+            if (fnd == this->_connections.end()) continue;
+
+            auto & connection = fnd->second;
+            bool pending = connection->hasPendingOutput();
+            bool open = !(events[i].events & (EPOLLERR | EPOLLHUP)) || (events[i].events & EPOLLIN);
+            if (open && (events[i].events & EPOLLIN)) open = connection->onReadable();
+            if (open && (events[i].events & EPOLLOUT)) open = connection->onWritable();
+
+            if (!open) {
+                this->close(fd);
+            } else if (pending != connection->hasPendingOutput()) {
+                // only wait for the socket to be writable while there are responses to send
+                this->watch(fd, connection->hasPendingOutput());
+            }
+        }
+    }
+
+    this->_connections.clear();
+}
+
+void Reactor::stop() {
+    this->_stop = true;
+    uint64_t one = 1;
+    if (write(this->_wakeup, &one, sizeof(one)) < 0) {
+        XLOG(ERR, "Could not wake up reactor: ", strerror(errno));
+    }
+}
+
+int Reactor::listen(const std::string& address, int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) throw std::runtime_error(std::string("socket: ") + strerror(errno));
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one));
+
+    sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        ::close(fd);
+        throw std::runtime_error("Invalid server address " + address);
+    }
+
+    if (bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 || ::listen(fd, SOMAXCONN) < 0) {
+        std::string error = strerror(errno);
+        ::close(fd);
+        throw std::runtime_error("Could not listen on " + address + ":" + std::to_string(port) + " - " + error);
+    }
+
+    return fd;
+}
+
+void Reactor::accept(int listener) {
+    while (true) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) XLOG(ERR, "accept failed: ", strerror(errno));
+            return;
+        }
+
+        // responses are small and pipelined, they must not wait for acks
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        this->_connections[fd] = std::make_unique<Connection>(fd, this->_listeners[listener], this->_router);
+        this->watch(fd, false);
+    }
+}
+
+void Reactor::close(int fd) {
+    epoll_ctl(this->_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    this->_connections.erase(fd);
+}
+
+void Reactor::watch(int fd, bool writable) {
+    epoll_event event = {};
+    event.events = EPOLLIN | (writable ? (uint32_t) EPOLLOUT : 0);
+    event.data.fd = fd;
+
+    if (epoll_ctl(this->_epoll, EPOLL_CTL_MOD, fd, &event) < 0) {
+        if (errno != ENOENT || epoll_ctl(this->_epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+            XLOG(ERR, "epoll_ctl failed: ", strerror(errno));
+        }
+    }
+}
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================          SERVER         ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+Server::Server() {}
+
+Server::~Server() {
+    this->stop();
+}
+
+void Server::configure(const std::string& address, unsigned int nb_reactors) {
+    this->_address = address;
+    this->_nb_reactors = nb_reactors != 0 ? nb_reactors : std::max(std::thread::hardware_concurrency(), (unsigned int) 1);
+}
+
+Router& Server::getRouter() {
+    return this->_router;
+}
+
+void Server::start() {
+    XLOG(INFO, "Starting memcached server on ", this->_address, " with ", this->_nb_reactors, " reactors");
+    for (unsigned int i = 0; i < this->_nb_reactors; i++) {
+        auto reactor = std::make_unique<Reactor>();
+        reactor->configure(this->_address, &this->_router);
+        this->_reactors.push_back(std::move(reactor));
+    }
+
+    for (auto & reactor: this->_reactors) {
+        this->_threads.push_back(spawn(reactor.get(), &Reactor::run));
+    }
+}
+
+void Server::stop() {
+    if (this->_reactors.empty()) return;
+
+    for (auto & reactor: this->_reactors) {
+        reactor->stop();
+    }
+
+    for (auto & thread: this->_threads) {
+        join(thread);
+    }
+
+    this->_threads.clear();
+    this->_reactors.clear();
+}
+
+bool Server::isRunning() const {
+    return !this->_reactors.empty();
+}
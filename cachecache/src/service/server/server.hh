@@ -0,0 +1,90 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <rd_utils/concurrency/thread.hh>
+#include <service/cachecache.hh>
+#include <service/server/router.hh>
+#include <service/server/connection.hh>
+
+namespace cachecache {
+    /**
+     * An epoll event loop serving the connections it accepted
+     * Every reactor listens on every port with SO_REUSEPORT, the kernel balances the connections between them
+     */
+    class Reactor {
+        public:
+            Reactor();
+            ~Reactor();
+
+            Reactor(const Reactor&) = delete;
+            void operator=(const Reactor&) = delete;
+
+            void configure(const std::string& address, const Router* router);
+
+            void run(rd_utils::concurrency::Thread);
+            void run();
+
+            /**
+             * Ask the event loop to stop, can be called from any thread
+             */
+            void stop();
+
+        private:
+            static constexpr int MAX_EVENTS = 64;
+
+            const Router* _router;
+
+            int _epoll = -1;
+            // eventfd waking up the event loop on stop
+            int _wakeup = -1;
+            std::atomic<bool> _stop = false;
+
+            // mapping between a listening socket and the cache of its port
+            std::unordered_map<int, Cachecache*> _listeners;
+            std::unordered_map<int, std::unique_ptr<Connection>> _connections;
+
+            int listen(const std::string& address, int port);
+            void accept(int listener);
+            void close(int fd);
+            void watch(int fd, bool writable);
+    };
+
+    /**
+     * Memcached server in front of the caches, with one reactor per core
+     */
+    class Server {
+        public:
+            Server();
+            ~Server();
+
+            Server(const Server&) = delete;
+            void operator=(const Server&) = delete;
+
+            /**
+             * @params:
+             *    - nb_reactors: the number of event loops, 0 for one per core
+             */
+            void configure(const std::string& address, unsigned int nb_reactors);
+
+            Router& getRouter();
+
+            void start();
+            void stop();
+
+            bool isRunning() const;
+
+        private:
+            std::string _address;
+            unsigned int _nb_reactors = 1;
+
+            Router _router;
+
+            std::vector<std::unique_ptr<Reactor>> _reactors;
+            std::vector<rd_utils::concurrency::Thread> _threads;
+    };
+}
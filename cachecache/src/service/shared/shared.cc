@@ -0,0 +1,166 @@
+#include "shared.hh"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "folly/logging/xlog.h"
+#include "folly/logging/LogLevel.h"
+#include "cachelib/allocator/LruTailAgeStrategy.h"
+#include "cachelib/allocator/memory/Slab.h"
+#include <service/cachecache.hh>
+
+using namespace cachecache;
+
+using Cache = facebook::cachelib::LruAllocator;
+using CacheConfig = typename Cache::Config;
+using MMConfig = typename Cache::MMConfig;
+using facebook::cachelib::PoolId;
+using facebook::cachelib::Slab;
+
+SharedAllocator::SharedAllocator() {}
+
+SharedAllocator::~SharedAllocator() {
+    this->_cache.reset();
+}
+
+void SharedAllocator::configure(size_t cachesize, const std::string& persistence) {
+    this->_cachesize = cachesize;
+
+    facebook::cachelib::util::Throttler::Config throttler;
+    throttler.workMs = Cachecache::REAPER_WORK_MS;
+    throttler.sleepMs = Cachecache::REAPER_SLEEP_MS;
+
+    CacheConfig config;
+    config
+        .setCacheSize(cachesize)
+        .setCacheName("Cachecache")
+        .enableItemReaperInBackground(std::chrono::milliseconds(Cachecache::REAPER_INTERVAL_MS), throttler)
+        .setAccessConfig(
+            {25 /* bucket power */, 10 /* lock power */}) // a single hash table for all the caches
+        .validate(); // will throw if bad config
+
+    if (!persistence.empty()) {
+        config.enableCachePersistence(persistence);
+        this->_persistent = true;
+        try {
+            this->_cache = std::make_shared<Cache>(Cache::SharedMemAttach, config);
+            this->_restored = true;
+            XLOG(INFO, "Restored shared allocator from ", persistence);
+        } catch (const std::exception& e) {
+            XLOG(INFO, "Could not restore shared allocator from ", persistence, " : ", e.what());
+            this->_cache = std::make_shared<Cache>(Cache::SharedMemNew, config);
+        }
+    } else {
+        this->_cache = std::make_shared<Cache>(config);
+    }
+
+    facebook::cachelib::LruTailAgeStrategy::Config cfg;
+    cfg.slabProjectionLength = 0; // dont project or estimate tail age
+    cfg.numSlabsFreeMem = 1;     // ok to have ~40 MB free memory in unused allocations
+    this->_cache->startNewPoolResizer(std::chrono::milliseconds(500), 99999, std::make_shared<facebook::cachelib::LruTailAgeStrategy>(cfg));
+}
+
+PoolId SharedAllocator::addPool(const std::string& name, size_t size) {
+    std::scoped_lock lock(this->_mutex);
+    if (this->_restored) {
+        try {
+            auto pool = this->_cache->getPoolId(name);
+            this->_pools[name] = pool;
+            return pool;
+        } catch (const std::exception& e) {
+            XLOG(INFO, "No saved pool for ", name, ", creating it");
+        }
+    }
+
+    size_t free = this->_cache->getCacheMemoryStats().unReservedSize;
+    size = std::min((std::max(Slab::kSize, size) / Slab::kSize) * Slab::kSize, (free / Slab::kSize) * Slab::kSize);
+    if (size == 0 || this->_pools.size() == MAX_POOLS) {
+        XLOG(ERR, "No memory left in the shared allocator for the pool of ", name);
+        return Slab::kInvalidPoolId;
+    }
+
+    MMConfig mmConfig;
+    mmConfig.lruRefreshTime = 0;
+    mmConfig.updateOnRead = true;
+    mmConfig.updateOnWrite = true;
+    auto pool = this->_cache->addPool(name, size, {}, mmConfig);
+
+    this->_pools[name] = pool;
+    XLOG(INFO, "Pool ", (int) pool, " of ", size, " bytes for ", name);
+
+    return pool;
+}
+
+void SharedAllocator::rebalance(const std::unordered_map<std::string, size_t>& targets) {
+    std::scoped_lock lock(this->_mutex);
+
+    // the pools giving memory, and the ones receiving it, with the amount in bytes
+    std::vector<std::pair<PoolId, size_t>> donors;
+    std::vector<std::pair<PoolId, size_t>> receivers;
+    for (auto & [name, target]: targets) {
+        auto fnd = this->_pools.find(name);
+        if (fnd == this->_pools.end()) {
+            XLOG(ERR, "Resize of unknown pool ", name);
+            continue;
+        }
+
+        size_t current = this->_cache->getPool(fnd->second).getPoolSize();
+        size_t wanted = std::max((size_t) 1, target / Slab::kSize) * Slab::kSize;
+        if (current > wanted) donors.emplace_back(fnd->second, current - wanted);
+        else if (current < wanted) receivers.emplace_back(fnd->second, wanted - current);
+    }
+
+    // the memory moves from pool to pool first, it stays reserved in the allocator
+    size_t d = 0;
+    for (auto & [dst, needed]: receivers) {
+        while (needed != 0 && d < donors.size()) {
+            auto & [src, extra] = donors[d];
+            size_t amount = std::min(needed, extra);
+            if (this->_cache->resizePools(src, dst, amount)) {
+                needed -= amount;
+                extra -= amount;
+            } else {
+                XLOG(ERR, "Could not move ", amount, " bytes from pool ", (int) src, " to pool ", (int) dst);
+                extra = 0;
+            }
+
+            if (extra == 0) d++;
+        }
+    }
+
+    // what is left is given back to, or taken from, the memory reserved by no pool
+    for (; d < donors.size(); d++) {
+        if (donors[d].second != 0 && !this->_cache->shrinkPool(donors[d].first, donors[d].second)) {
+            XLOG(ERR, "Could not shrink pool ", (int) donors[d].first, " by ", donors[d].second, " bytes");
+        }
+    }
+
+    for (auto & [dst, needed]: receivers) {
+        if (needed != 0 && !this->_cache->growPool(dst, needed)) {
+            XLOG(ERR, "Could not grow pool ", (int) dst, " by ", needed, " bytes");
+        }
+    }
+}
+
+bool SharedAllocator::restored() const {
+    return this->_restored;
+}
+
+void SharedAllocator::shutDown() {
+    if (!this->_persistent) return;
+
+    if (this->_cache->shutDown() == facebook::cachelib::ShutDownStatus::kSuccess) {
+        XLOG(INFO, "Shared allocator saved");
+    } else {
+        XLOG(ERR, "Shared allocator could not be saved, the caches will start empty");
+    }
+}
+
+std::shared_ptr<Cache> SharedAllocator::getCache() const {
+    return this->_cache;
+}
+
+size_t SharedAllocator::size() const {
+    return this->_cachesize;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "cachelib/allocator/CacheAllocator.h"
+
+namespace cachecache {
+    /**
+     * A single cachelib allocator shared by the caches, each cache being one of its pools
+     * Memory changes owner by moving slabs between the pools, it is never given back to the OS
+     */
+    class SharedAllocator {
+        public:
+            SharedAllocator();
+            ~SharedAllocator();
+
+            SharedAllocator(const SharedAllocator&) = delete;
+            void operator=(const SharedAllocator&) = delete;
+
+            /**
+             * @params:
+             *    - cachesize: the memory shared by all the pools in bytes
+             *    - persistence: directory where cachelib saves the allocator at shutdown, not persistent if empty
+             */
+            void configure(size_t cachesize, const std::string& persistence = "");
+
+            /**
+             * @returns: true if the allocator and its pools were restored from a previous run
+             */
+            bool restored() const;
+
+            /**
+             * Save the allocator if it is persistent, the pools cannot be used afterwards
+             */
+            void shutDown();
+
+            /**
+             * Create the pool of a cache, or find it if the allocator was restored
+             * @params:
+             *    - size: the initial size of the pool, capped by the memory not reserved by the other pools
+             * @returns: the id of the pool, Slab::kInvalidPoolId if there is no memory left
+             */
+            facebook::cachelib::PoolId addPool(const std::string& name, size_t size);
+
+            /**
+             * Resize the pools to their target sizes (in slabs, at least one)
+             * The memory of the shrinking pools is moved to the growing ones, the pool resizer then moves the slabs
+             */
+            void rebalance(const std::unordered_map<std::string, size_t>& targets);
+
+            std::shared_ptr<facebook::cachelib::LruAllocator> getCache() const;
+            size_t size() const;
+
+        private:
+            // maximal number of pools of a cachelib allocator
+            static constexpr size_t MAX_POOLS = 64;
+
+            std::shared_ptr<facebook::cachelib::LruAllocator> _cache;
+            size_t _cachesize = 0;
+            bool _persistent = false;
+            bool _restored = false;
+
+            std::unordered_map<std::string, facebook::cachelib::PoolId> _pools;
+
+            // a single rebalance at a time, the pool sizes are read then changed
+            std::mutex _mutex;
+    };
+}
@@ -0,0 +1,145 @@
+#include "sketch.hh"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include <service/state/state.hh>
+
+using namespace cachecache;
+
+QuantileSketch::QuantileSketch(): QuantileSketch(0.01) {}
+
+QuantileSketch::QuantileSketch(double accuracy):
+    _accuracy(accuracy)
+    , _gamma((1 + accuracy) / (1 - accuracy))
+    , _log_gamma(std::log(_gamma))
+    , _min_index((int) std::ceil(std::log(MIN_VALUE) / _log_gamma))
+    , _nb_buckets((unsigned int) (std::ceil(std::log(MAX_VALUE) / _log_gamma) - _min_index) + 2)
+    , _buckets(std::make_unique<std::atomic<uint64_t>[]>(_nb_buckets)) {
+    this->reset();
+}
+
+QuantileSketch::QuantileSketch(QuantileSketch&& other):
+    _accuracy(other._accuracy)
+    , _gamma(other._gamma)
+    , _log_gamma(other._log_gamma)
+    , _min_index(other._min_index)
+    , _nb_buckets(other._nb_buckets)
+    , _buckets(std::move(other._buckets))
+    , _total(other._total.load()) {
+        other._nb_buckets = 0;
+        other._total = 0;
+}
+
+void QuantileSketch::operator=(QuantileSketch&& other) {
+    this->_accuracy = other._accuracy;
+    this->_gamma = other._gamma;
+    this->_log_gamma = other._log_gamma;
+    this->_min_index = other._min_index;
+    this->_nb_buckets = other._nb_buckets;
+    this->_buckets = std::move(other._buckets);
+    this->_total = other._total.load();
+
+    other._nb_buckets = 0;
+    other._total = 0;
+}
+
+void QuantileSketch::record(double value) {
+    this->_buckets[this->bucket(value)].fetch_add(WEIGHT, std::memory_order_relaxed);
+    this->_total.fetch_add(WEIGHT, std::memory_order_relaxed);
+}
+
+double QuantileSketch::quantile(double q) const {
+    uint64_t total = this->_total.load(std::memory_order_relaxed);
+    if (total == 0) return 0;
+
+    double rank = std::clamp(q, 0.0, 1.0) * total;
+    uint64_t cumulated = 0;
+    for (unsigned int i = 0; i < this->_nb_buckets; i++) {
+        cumulated += this->_buckets[i].load(std::memory_order_relaxed);
+        if (cumulated >= rank && cumulated > 0) {
+            return this->value(i);
+        }
+    }
+
+    return this->value(this->_nb_buckets - 1);
+}
+
+double QuantileSketch::count() const {
+    return (double) this->_total.load(std::memory_order_relaxed) / (double) WEIGHT;
+}
+
+void QuantileSketch::merge(const QuantileSketch& other) {
+    for (unsigned int i = 0; i < std::min(this->_nb_buckets, other._nb_buckets); i++) {
+        this->_buckets[i].fetch_add(other._buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    this->_total.fetch_add(other._total.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+void QuantileSketch::decay(double factor) {
+    if (factor >= 1) return;
+
+    // the weight removed is subtracted, so a value recorded concurrently is never lost, it is kept whole or decayed
+    uint64_t removed = 0;
+    for (unsigned int i = 0; i < this->_nb_buckets; i++) {
+        uint64_t weight = this->_buckets[i].load(std::memory_order_relaxed);
+        uint64_t decrease = weight - (uint64_t) (weight * factor);
+        this->_buckets[i].fetch_sub(decrease, std::memory_order_relaxed);
+        removed += decrease;
+    }
+    this->_total.fetch_sub(removed, std::memory_order_relaxed);
+}
+
+void QuantileSketch::reset() {
+    for (unsigned int i = 0; i < this->_nb_buckets; i++) {
+        this->_buckets[i].store(0, std::memory_order_relaxed);
+    }
+    this->_total = 0;
+}
+
+double QuantileSketch::getAccuracy() const {
+    return this->_accuracy;
+}
+
+unsigned int QuantileSketch::bucket(double value) const {
+    if (value < MIN_VALUE) return 0;
+
+    int index = (int) std::ceil(std::log(value) / this->_log_gamma);
+    return std::min((unsigned int) (index - this->_min_index + 1), this->_nb_buckets - 1);
+}
+
+double QuantileSketch::value(unsigned int bucket) const {
+    if (bucket == 0) return 0;
+
+    // middle of the bucket, in relative terms
+    int index = (int) bucket - 1 + this->_min_index;
+    return 2 * std::pow(this->_gamma, index) / (this->_gamma + 1);
+}
+
+void QuantileSketch::save(std::ostream& out) const {
+    state::write(out, this->_accuracy);
+    state::write(out, this->_nb_buckets);
+    for (unsigned int i = 0; i < this->_nb_buckets; i++) {
+        state::write(out, this->_buckets[i].load(std::memory_order_relaxed));
+    }
+}
+
+bool QuantileSketch::load(std::istream& in) {
+    double accuracy;
+    unsigned int nb_buckets;
+    if (!state::read(in, accuracy) || !state::read(in, nb_buckets)) return false;
+    if (accuracy != this->_accuracy || nb_buckets != this->_nb_buckets) return false;
+
+    std::vector<uint64_t> buckets(nb_buckets);
+    for (auto & b: buckets) {
+        if (!state::read(in, b)) return false;
+    }
+
+    uint64_t total = 0;
+    for (unsigned int i = 0; i < nb_buckets; i++) {
+        this->_buckets[i].store(buckets[i], std::memory_order_relaxed);
+        total += buckets[i];
+    }
+    this->_total.store(total, std::memory_order_relaxed);
+
+    return true;
+}
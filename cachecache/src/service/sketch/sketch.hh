@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+
+// DDSketch impl based on (https://arxiv.org/abs/1908.10693)
+namespace cachecache {
+    /**
+     * Histogram of values in logarithmic buckets, any quantile is estimated with a bounded relative error
+     * Values are recorded concurrently without locks, sketches with the same accuracy can be merged
+     * The weight of the recorded values can be decayed to follow the drift of the distribution
+     */
+    class QuantileSketch {
+        public:
+            QuantileSketch();
+
+            /**
+             * @params:
+             *    - accuracy: the relative error of the estimated quantiles (e.g. 0.01 for 1%)
+             */
+            explicit QuantileSketch(double accuracy);
+
+            QuantileSketch(const QuantileSketch&) = delete;
+            void operator=(const QuantileSketch&) = delete;
+
+            QuantileSketch(QuantileSketch&&);
+            void operator=(QuantileSketch&&);
+
+            void record(double value);
+
+            /**
+             * @params:
+             *    - q: the quantile in [0, 1]
+             * @returns: the estimation of the quantile, 0 if nothing was recorded
+             */
+            double quantile(double q) const;
+
+            /**
+             * @returns: the decayed number of recorded values
+             */
+            double count() const;
+
+            /**
+             * Add the values recorded by other, that must have the same accuracy
+             */
+            void merge(const QuantileSketch& other);
+
+            /**
+             * Multiply the weight of every value recorded so far by factor in [0, 1]
+             */
+            void decay(double factor);
+
+            void reset();
+
+            double getAccuracy() const;
+
+            void save(std::ostream& out) const;
+
+            /**
+             * Replace the recorded values by the ones saved by a sketch of the same accuracy
+             * @returns: false if the saved sketch cannot be read, the sketch is then unchanged
+             */
+            bool load(std::istream& in);
+
+        private:
+            // values below are counted as 0
+            static constexpr double MIN_VALUE = 1e-3;
+            // values above are counted in the last bucket
+            static constexpr double MAX_VALUE = 1e10;
+            // fixed point weight of one value, so decayed weights keep some precision
+            static constexpr uint64_t WEIGHT = 256;
+
+            double _accuracy;
+            double _gamma;
+            double _log_gamma;
+            int _min_index;
+            unsigned int _nb_buckets;
+
+            // bucket 0 counts the values below MIN_VALUE
+            std::unique_ptr<std::atomic<uint64_t>[]> _buckets;
+            std::atomic<uint64_t> _total = 0;
+
+            unsigned int bucket(double value) const;
+            double value(unsigned int bucket) const;
+    };
+}
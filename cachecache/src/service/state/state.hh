@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+/**
+ * Raw binary encoding of the state saved across restarts
+ * The files are only read back by the same binary on the same machine, no care is taken of the endianness
+ */
+namespace cachecache::state {
+    template <typename T>
+    void write(std::ostream& out, const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    /**
+     * @returns: false if the stream ended before the value
+     */
+    template <typename T>
+    bool read(std::istream& in, T& value) {
+        static_assert(std::is_trivially_copyable_v<T>);
+        return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+    }
+
+    inline void writeString(std::ostream& out, const std::string& value) {
+        write<uint32_t>(out, value.size());
+        out.write(value.data(), value.size());
+    }
+
+    inline bool readString(std::istream& in, std::string& value) {
+        uint32_t size;
+        if (!read(in, size)) return false;
+        value.resize(size);
+        return static_cast<bool>(in.read(value.data(), size));
+    }
+}
@@ -1,8 +1,12 @@
 #include <service/supervisor/supervisor.hh>
 #include <unistd.h>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <thread>
 #include "cachelib/common/PeriodicWorker.h"
 #include "cachelib/allocator/memory/Slab.h"
+#include <service/state/state.hh>
 
 using namespace cachecache;
 using namespace rd_utils::utils;
@@ -15,26 +19,41 @@ std::unordered_map<std::string, Cachecache>& Supervisor::getRunningCaches() {
     return this->_caches;
 }
 
+bool Supervisor::requestStop() {
+    return _stop_requested.exchange(true);
+}
+
 void Supervisor::run() {
     // start each generator in its own thread 
     for(auto & generator: this->_generators) {
         this->_threads.push_back(spawn(&generator.second, &Generator::run));
     }
 
-    //facebook::cachelib::util::startPeriodicWorker("market", this->_market, std::chrono::milliseconds(500));
-    /*MarketConfig marketCfg = {
-        this->_cachesize, // global memory pool 
-        0.75, // percentage of memory used before triggering an increment
-        0.1, // percentage of increment 
-        0.3, // percentage of memory used before triggering a decrement 
-        0.1, // percentage of decrement 
-        3 * facebook::cachelib::Slab::kSize,
-    };
+    // replaying as fast as possible, the market works at the end of the rounds
+    if (this->_market != nullptr && this->_rounds == nullptr) {
+        this->_market->start(std::chrono::milliseconds(this->_market_period), "market");
+    }
 
-    this->_market->configure(marketCfg, &this->_metrics);
-    for (auto & [name, cache]: this->_caches) {
-        this->_market->register_cache(name, &cache);
-    }*/
+    if (this->_exporter != nullptr) {
+        try {
+            this->_exporter->start();
+        } catch (const std::runtime_error& e) {
+            LOG_ERROR("Could not start metrics exporter : ", e.what());
+            exit(-1);
+        }
+    }
+
+    if (this->_server != nullptr) {
+        try {
+            this->_server->start();
+        } catch (const std::runtime_error& e) {
+            LOG_ERROR("Could not start memcached server : ", e.what());
+            exit(-1);
+        }
+    }
+
+    // replaying as fast as possible, the caches are cleaned at the end of the rounds
+    this->_cleaner.start(this->_rounds == nullptr);
 
     sleep(1);
 
@@ -44,24 +63,143 @@ void Supervisor::run() {
             if (!(*finished)) all_finished = false;
         }
 
-        if (all_finished) break;
+        // a server keeps serving its clients once the traces are replayed, at the pace of the generators
+        if (all_finished && (this->_server == nullptr || this->_rounds != nullptr)) break;
 
+        if (_stop_requested) {
+            LOG_INFO("Stop requested");
+            for (auto & [cache_name, generator]: this->_generators) {
+                generator.stop();
+            }
+            break;
+        }
+
+        // the clocks and the cleans follow the rounds of the generators
+        if (this->_rounds != nullptr) {
+            sleep(1);
+            continue;
+        }
+
+        // caches without generator are only driven by the clients of the server
         for (auto & [cache_name, cache]: this->_caches) {
-            cache.clean();
+            if (this->_generators.find(cache_name) == this->_generators.end()) {
+                // a virtual clock moves one second per loop, a realtime clock moves on its own
+                this->_clocks.at(cache_name).update();
+                cache.push_metrics();
+            }
         }
 
-        sleep(3);
+        sleep(1);
     }
 
     for(auto & thread: this->_threads) {
         join(thread);
     }
 
-    //facebook::cachelib::util::stopPeriodicWorker("market", this->_market);
+    this->_cleaner.stop();
+
+    if (this->_rounds != nullptr) {
+        LOG_INFO("Replayed ", this->_rounds->seconds(), " seconds of traces");
+    }
+
+    if (this->_server != nullptr) {
+        this->_server->stop();
+    }
+
+    if (this->_exporter != nullptr) {
+        this->_exporter->stop();
+    }
+
+    if (this->_market != nullptr) {
+        this->_market->stop();
+    }
+
+    if (!this->_persistence.empty()) {
+        this->persist();
+    }
 
     sleep(1);
 }
 
+void Supervisor::persist() {
+    auto path = std::filesystem::path(this->_persistence) / "state";
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+
+    state::write(out, STATE_MAGIC);
+    state::write(out, STATE_VERSION);
+    state::write<uint32_t>(out, this->_caches.size());
+    for (auto & [name, cache]: this->_caches) {
+        state::writeString(out, name);
+        state::write(out, this->_clocks.at(name).time());
+        cache.save(out);
+    }
+
+    state::write<uint8_t>(out, this->_market != nullptr);
+    if (this->_market != nullptr) {
+        this->_market->save(out);
+    }
+
+    out.close();
+    if (!out) {
+        LOG_ERROR("Could not save the state of the caches in ", path.string());
+    }
+
+    for (auto & [name, cache]: this->_caches) {
+        cache.shutDown();
+    }
+
+    if (this->_allocator != nullptr) {
+        this->_allocator->shutDown();
+    }
+}
+
+void Supervisor::loadState() {
+    auto path = std::filesystem::path(this->_persistence) / "state";
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        LOG_INFO("No saved state in ", this->_persistence);
+        return;
+    }
+
+    uint64_t magic;
+    uint32_t version, nb;
+    if (!state::read(in, magic) || magic != STATE_MAGIC || !state::read(in, version) || version != STATE_VERSION || !state::read(in, nb)) {
+        LOG_WARN("Ignoring invalid state file ", path.string());
+        return;
+    }
+
+    bool complete = true;
+    for (uint32_t i = 0; i < nb && complete; i++) {
+        std::string name;
+        uint64_t time;
+        if (!state::readString(in, name) || !state::read(in, time)) {
+            complete = false;
+            break;
+        }
+
+        // the states are not self delimited, the ones after an unknown cache cannot be read
+        auto fnd = this->_caches.find(name);
+        if (fnd == this->_caches.end() || !fnd->second.load(in)) {
+            LOG_WARN("Could not restore the state of cache ", name);
+            complete = false;
+            break;
+        }
+
+        this->_clocks.at(name).restore(time);
+        LOG_INFO("Restored cache ", name, " at time ", time, fnd->second.restored() ? " with its items" : " without its items");
+    }
+
+    uint8_t has_market = 0;
+    if (complete && state::read(in, has_market) && has_market && this->_market != nullptr) {
+        if (!this->_market->load(in)) {
+            LOG_WARN("Could not restore the wallets of the market");
+        }
+    }
+
+    in.close();
+    std::filesystem::remove(path);
+}
+
 void Supervisor::configure(int argc, char ** argv) {
     this-> _argc = argc;
     this-> _argv = argv;
@@ -94,11 +232,61 @@ void Supervisor::initAppOptions() {
 }
 
 void Supervisor::configure(const std::shared_ptr<rd_utils::utils::config::ConfigNode> & config) {
+    std::string output_directory = "/tmp";
+    size_t clean_workers = std::min(std::max(std::thread::hardware_concurrency(), (unsigned int) 1), (unsigned int) 4);
     if ((*config).contains("main")) {
         auto & main_config = (*config)["main"];
         this->_cachesize = main_config["cache_size"].getI() * 1024 * 1024;
+        if (main_config.contains("output_directory")) {
+            output_directory = main_config["output_directory"].getStr();
+        }
+
+        if (main_config.contains("persistence_directory")) {
+            this->_persistence = main_config["persistence_directory"].getStr();
+            try {
+                std::filesystem::create_directories(this->_persistence);
+            } catch (const std::filesystem::filesystem_error& e) {
+                LOG_ERROR("Could not create persistence directory ", this->_persistence, " : ", e.what());
+                exit(-1);
+            }
+        }
+
+        if (main_config.contains("replay")) {
+            auto & mode = main_config["replay"].getStr();
+            if (mode == "afap") {
+                this->_rounds = std::make_unique<Rounds>();
+                this->_metrics.setClock(&this->_trace_clock);
+            } else if (mode != "paced") {
+                LOG_ERROR("Unknown replay mode ", mode, ", expected paced or afap");
+                exit(-1);
+            }
+        }
+
+        if (main_config.contains("clean_period")) {
+            this->_clean_period = std::max((int) main_config["clean_period"].getI(), 1);
+        }
+
+        if (main_config.contains("clean_workers")) {
+            clean_workers = std::max((int) main_config["clean_workers"].getI(), 1);
+        }
+
+        if (main_config.contains("allocator")) {
+            auto & mode = main_config["allocator"].getStr();
+            if (mode == "shared") {
+                this->_allocator = std::make_unique<SharedAllocator>();
+                this->_allocator->configure(this->_cachesize, this->persistenceDirectory("shared"));
+            } else if (mode != "per_cache") {
+                LOG_ERROR("Unknown allocator mode ", mode, ", expected per_cache or shared");
+                exit(-1);
+            }
+        }
     }
-    this->_metrics.configure("/tmp");
+    this->_metrics.configure(output_directory);
+
+    // port dedicated to each cache served by the memcached front-end
+    std::unordered_map<std::string, int> cache_ports;
+    // sampling rate of the miss ratio curve of each cache, when given
+    std::unordered_map<std::string, double> mrc_rates;
 
 
     if((*config).contains("caches")) {
@@ -109,19 +297,74 @@ void Supervisor::configure(const std::shared_ptr<rd_utils::utils::config::Config
                     
                     auto & name = cache_config["name"].getStr();
                     size_t requested = cache_config["requested"].getI() * 1024 * 1024;
-                    double p0 = 0.75; //cache_config["p0"].getF();// / 100.f;
-                    double p1 = 0.95; //cache_config["p1"].getF();// / 100.f;
-                    double p2 = 0.9999; //cache_config["p2"].getF();// / 100.f;
+                    double p0 = cache_config.contains("p0") ? cache_config["p0"].getF() : 0.75;
+                    double p1 = cache_config.contains("p1") ? cache_config["p1"].getF() : 0.95;
+                    double p2 = cache_config.contains("p2") ? cache_config["p2"].getF() : 0.9999;
 
                     XLOG(INFO, "CONFIG ", p0, " ", p1, " ", p2);
 
-                    Clock clock;
+                    if (cache_config.contains("nvm_path")) {
+                        if (this->_allocator != nullptr) {
+                            LOG_ERROR("Cache ", name, " declares a flash tier, it needs its own allocator (allocator = \"per_cache\")");
+                            exit(-1);
+                        }
+                        size_t nvm_size = (cache_config.contains("nvm_size") ? cache_config["nvm_size"].getI() : 1024) * 1024 * 1024;
+                        this->_caches[name].configureNvm(cache_config["nvm_path"].getStr(), nvm_size);
+                    }
+
+                    CLOCK_SOURCE source = CLOCK_SOURCE::VIRTUAL;
+                    if (cache_config.contains("clock")) {
+                        auto fnd = STR_TO_CLOCK_SOURCE.find(cache_config["clock"].getStr());
+                        if (fnd == STR_TO_CLOCK_SOURCE.end()) {
+                            LOG_ERROR("Unknown clock ", cache_config["clock"].getStr(), " for cache ", name);
+                            exit(-1);
+                        }
+                        source = fnd->second;
+                    }
+
+                    // the caches replayed as fast as possible must not depend on the speed of the machine
+                    if (source == CLOCK_SOURCE::REALTIME && this->_rounds != nullptr) {
+                        LOG_ERROR("Cache ", name, " has a realtime clock, the afap replay needs virtual clocks");
+                        exit(-1);
+                    }
+
+                    Clock clock(source);
                     this->_clocks.insert_or_assign(name, std::move(clock));
 
                     //Cachecache cache;
                     //cache.configure(size, p0, p1, p2, &this->_clocks.at(name));
                     //this->_caches.insert_or_assign(name, std::move(cache));
-                    this->_caches[name].configure(name, this->_cachesize, requested, p0, p1, p2, &this->_clocks.at(name), &this->_metrics); 
+                    if (this->_allocator != nullptr) {
+                        try {
+                            this->_caches[name].configure(name, this->_allocator.get(), requested, p0, p1, p2, &this->_clocks.at(name), &this->_metrics);
+                        } catch (const std::runtime_error& e) {
+                            LOG_ERROR("Could not create the pool of cache ", name, " : ", e.what());
+                            exit(-1);
+                        }
+                    } else {
+                        this->_caches[name].configure(name, this->_cachesize, requested, p0, p1, p2, &this->_clocks.at(name), &this->_metrics, this->persistenceDirectory(name));
+                    }
+
+                    if (cache_config.contains("decay")) {
+                        this->_caches[name].setDecay(cache_config["decay"].getF(), Clock::fromSeconds(this->_clean_period));
+                    }
+
+                    if (cache_config.contains("admission_threshold")) {
+                        unsigned int threshold = cache_config["admission_threshold"].getI();
+                        uint64_t capacity = 1000000;
+                        if (cache_config.contains("admission_size")) {
+                            capacity = cache_config["admission_size"].getI();
+                        }
+                        this->_caches[name].configureAdmission(capacity, threshold);
+                    }
+
+                    if (cache_config.contains("port")) {
+                        cache_ports.emplace(name, cache_config["port"].getI());
+                    }
+
+                    if (cache_config.contains("mrc_rate")) {
+                        mrc_rates.emplace(name, cache_config["mrc_rate"].getF());
+                    }
                 }
             } elfo {
                 LOG_ERROR("Caches declaration should be a TOML dict");
@@ -130,6 +373,102 @@ void Supervisor::configure(const std::shared_ptr<rd_utils::utils::config::Config
         }
     }
 
+    this->_cleaner.configure(clean_workers, std::chrono::seconds(this->_clean_period));
+    for (auto & [name, cache]: this->_caches) {
+        this->_cleaner.addCache(name, &cache);
+    }
+
+    if ((*config).contains("server")) {
+        auto & server_config = (*config)["server"];
+        std::string address = server_config.contains("address") ? server_config["address"].getStr() : "127.0.0.1";
+        unsigned int reactors = server_config.contains("reactors") ? server_config["reactors"].getI() : 0;
+
+        this->_server = std::make_unique<Server>();
+        this->_server->configure(address, reactors);
+
+        auto & router = this->_server->getRouter();
+        for (auto & [name, cache]: this->_caches) {
+            router.addCache(name, &cache);
+        }
+
+        for (auto & [name, port]: cache_ports) {
+            router.addPort(port, &this->_caches.at(name));
+        }
+
+        if (server_config.contains("port")) {
+            router.addPort(server_config["port"].getI(), nullptr);
+        }
+
+        if (router.getPorts().empty()) {
+            LOG_ERROR("Server declared without any port, set a shared port or a port per cache");
+            exit(-1);
+        }
+    } else if (!cache_ports.empty()) {
+        LOG_ERROR("Caches declare a port but there is no [server] section");
+        exit(-1);
+    }
+
+    BIDDING bidding = BIDDING::USAGE;
+    if ((*config).contains("market")) {
+        auto & market_config = (*config)["market"];
+        if (market_config.contains("bidding")) {
+            auto fnd = STR_TO_BIDDING.find(market_config["bidding"].getStr());
+            if (fnd == STR_TO_BIDDING.end()) {
+                LOG_ERROR("Unknown bidding mode ", market_config["bidding"].getStr(), " for the market");
+                exit(-1);
+            }
+            bidding = fnd->second;
+        }
+
+        MarketConfig cfg = {
+            this->_cachesize, // global memory pool
+            market_config.contains("trigger_increment") ? (float) market_config["trigger_increment"].getF() : 0.75f,
+            market_config.contains("increasing_speed") ? (float) market_config["increasing_speed"].getF() : 0.1f,
+            market_config.contains("trigger_decrement") ? (float) market_config["trigger_decrement"].getF() : 0.3f,
+            market_config.contains("decreasing_speed") ? (float) market_config["decreasing_speed"].getF() : 0.1f,
+            (market_config.contains("window_size") ? (size_t) market_config["window_size"].getI() : 3) * facebook::cachelib::Slab::kSize,
+            bidding,
+            market_config.contains("mrc_decay") ? market_config["mrc_decay"].getF() : 0.9,
+            market_config.contains("flash_value") ? market_config["flash_value"].getF() : 0.5,
+        };
+
+        if (market_config.contains("period")) {
+            this->_market_period = market_config["period"].getI();
+        }
+
+        this->_market = std::make_unique<Market>();
+        this->_market->configure(cfg, &this->_metrics);
+        this->_market->setSharedAllocator(this->_allocator.get());
+        for (auto & [name, cache]: this->_caches) {
+            this->_market->register_cache(name, &cache);
+        }
+    }
+
+    // utility bidding needs the miss ratio curves of every cache
+    for (auto & [name, cache]: this->_caches) {
+        auto fnd = mrc_rates.find(name);
+        double rate = fnd != mrc_rates.end() ? fnd->second : (bidding == BIDDING::UTILITY ? 0.01 : 0);
+        if (rate > 0) {
+            cache.configureMissRatioCurve(rate);
+        } else if (bidding == BIDDING::UTILITY) {
+            LOG_ERROR("Cache ", name, " has no miss ratio curve (mrc_rate = 0) but the market uses utility bidding");
+            exit(-1);
+        }
+    }
+
+    if ((*config).contains("exporter")) {
+        auto & exporter_config = (*config)["exporter"];
+        std::string address = exporter_config.contains("address") ? exporter_config["address"].getStr() : "127.0.0.1";
+        int port = exporter_config.contains("port") ? exporter_config["port"].getI() : 9464;
+
+        this->_exporter = std::make_unique<Exporter>();
+        this->_exporter->configure(address, port);
+        for (auto & [name, cache]: this->_caches) {
+            this->_exporter->addCache(name, &cache);
+        }
+        this->_exporter->setMarket(this->_market.get());
+    }
+
     if ((*config).contains("generators")) {
         match ((*config)["generators"]) {
             of (config::Dict, generators_config) {
@@ -141,6 +480,16 @@ void Supervisor::configure(const std::shared_ptr<rd_utils::utils::config::Config
                     int nb_seconds = generator_config["nb_seconds"].getI();
                     int frequency = generator_config["frequency"].getI();
 
+                    KEY_MODE key_mode = KEY_MODE::HASH;
+                    if (generator_config.contains("key_mode")) {
+                        auto fnd = STR_TO_KEY_MODE.find(generator_config["key_mode"].getStr());
+                        if (fnd == STR_TO_KEY_MODE.end()) {
+                            LOG_ERROR("Unknown key mode ", generator_config["key_mode"].getStr(), " for generator targeting ", target);
+                            exit(-1);
+                        }
+                        key_mode = fnd->second;
+                    }
+
                     if (this->_caches.find(target) == this->_caches.end()) {
                         LOG_ERROR("Generator wants to target non existing cache named ", target);
                         exit(-1);
@@ -150,7 +499,25 @@ void Supervisor::configure(const std::shared_ptr<rd_utils::utils::config::Config
                     this->_generator_finished.insert_or_assign(target, finished);
 
                     Generator generator;
-                    generator.configure(traces, nb_seconds, frequency, &this->_caches.at(target), &this->_clocks.at(target), finished);
+                    generator.configure(traces, nb_seconds, frequency, key_mode, &this->_caches.at(target), &this->_clocks.at(target), &this->_metrics, finished);
+                    if (generator_config.contains("batch_size")) {
+                        generator.setBatchSize(generator_config["batch_size"].getI());
+                    }
+                    if (generator_config.contains("workers")) {
+                        generator.setWorkers(generator_config["workers"].getI());
+                    }
+                    if (generator_config.contains("loop")) {
+                        auto fnd = STR_TO_LOOP.find(generator_config["loop"].getStr());
+                        if (fnd == STR_TO_LOOP.end()) {
+                            LOG_ERROR("Unknown loop mode ", generator_config["loop"].getStr(), " for generator targeting ", target);
+                            exit(-1);
+                        }
+                        if (fnd->second == LOOP::OPEN && this->_rounds != nullptr) {
+                            LOG_ERROR("Generator targeting ", target, " has an open loop, the afap replay has no intended send times");
+                            exit(-1);
+                        }
+                        generator.setLoop(fnd->second);
+                    }
                     this->_generators.insert_or_assign(target, std::move(generator));
                 }
             } elfo {
@@ -159,4 +526,58 @@ void Supervisor::configure(const std::shared_ptr<rd_utils::utils::config::Config
             }
         }
     }
+
+    if (this->_rounds != nullptr) {
+        this->configureRounds();
+    }
+
+    // the caches, clocks and market are all configured, their saved state can be restored
+    if (!this->_persistence.empty()) {
+        this->loadState();
+    }
+}
+
+std::string Supervisor::persistenceDirectory(const std::string& name) const {
+    if (this->_persistence.empty()) return "";
+
+    auto path = std::filesystem::path(this->_persistence) / name;
+    std::filesystem::create_directories(path);
+    return path.string();
+}
+
+void Supervisor::configureRounds() {
+    if (this->_generators.empty()) {
+        LOG_ERROR("The afap replay needs at least one generator");
+        exit(-1);
+    }
+
+    this->_rounds->configure(this->_generators.size());
+
+    // the generators move the clocks of their caches, the others move one second per round
+    this->_rounds->every(1, "clocks", [this]() {
+        this->_trace_clock.update();
+        for (auto & [cache_name, cache]: this->_caches) {
+            if (this->_generators.find(cache_name) == this->_generators.end()) {
+                this->_clocks.at(cache_name).update();
+                cache.push_metrics();
+            }
+        }
+    });
+
+    this->_rounds->every(this->_clean_period, "clean", [this]() {
+        this->_cleaner.cleanAll();
+    });
+
+    if (this->_market != nullptr) {
+        // the rounds are one second long, the period of the market is rounded up
+        uint64_t period = (this->_market_period + 999) / 1000;
+        this->_market->setSynchronous();
+        this->_rounds->every(period, "market", [this]() {
+            this->_market->work();
+        });
+    }
+
+    for (auto & [name, generator]: this->_generators) {
+        generator.setRounds(this->_rounds.get());
+    }
 }
@@ -2,6 +2,7 @@
 #include <rd_utils/foreign/CLI11.hh>
 #include <rd_utils/utils/_.hh>
 #include <rd_utils/concurrency/_.hh>
+#include <atomic>
 #include <memory>
 #include <string>
 #include <vector>
@@ -11,6 +12,10 @@
 #include <service/generator.hh>
 #include <service/metrics/metrics.hh>
 #include <service/market.hh>
+#include <service/cleaner/cleaner.hh>
+#include <service/rounds/rounds.hh>
+#include <service/server/server.hh>
+#include <service/exporter/exporter.hh>
 
 namespace cachecache {
     /**
@@ -30,9 +35,40 @@ namespace cachecache {
 
             std::unordered_map<std::string, Cachecache>& getRunningCaches();
 
+            /**
+             * Ask the running supervisor to stop and save the caches, safe to call from a signal handler
+             * @returns: true if a stop was already requested
+             */
+            static bool requestStop();
+
         private:
+            static inline std::atomic<bool> _stop_requested = false;
+
+            // header of the state file, followed by a version
+            static constexpr uint64_t STATE_MAGIC = 0x455441545343430a;
+            static constexpr uint32_t STATE_VERSION = 4;
+
+            // where the caches and the state around them are saved at shutdown, empty if they are not
+            std::string _persistence;
+
             Metrics _metrics;
+            // single allocator whose pools are the caches, nullptr if each cache has its own allocator
+            std::unique_ptr<SharedAllocator> _allocator;
+            // shares the memory between the caches, nullptr when not configured
             std::unique_ptr<Market> _market;
+            // time between two rounds of the market in ms
+            unsigned int _market_period = 500;
+            // time between two cleans of a cache under pressure in seconds (of traces when replaying as fast as possible)
+            unsigned int _clean_period = 3;
+
+            // generators replaying as fast as possible in lockstep, nullptr if they are paced by their frequency
+            std::unique_ptr<Rounds> _rounds;
+            // time of the traces replayed as fast as possible, the metrics are timestamped with it
+            Clock _trace_clock;
+            // memcached front-end, nullptr when the caches are only fed by generators
+            std::unique_ptr<Server> _server;
+            // OpenMetrics endpoint, nullptr when not configured
+            std::unique_ptr<Exporter> _exporter;
 
             // map between a name and its cache
             std::unordered_map<std::string, Cachecache> _caches; 
@@ -42,6 +78,9 @@ namespace cachecache {
             std::unordered_map<std::string, Generator> _generators;
             std::unordered_map<std::string, std::shared_ptr<bool>> _generator_finished;
 
+            // cleans the caches in parallel, declared after the caches so it stops before they are destroyed
+            Cleaner _cleaner;
+
             std::vector<rd_utils::concurrency::Thread> _threads;
 
 
@@ -63,5 +102,25 @@ namespace cachecache {
 
             void initAppOptions();
             void configure(const std::shared_ptr<rd_utils::utils::config::ConfigNode> & config);
+
+            /**
+             * Save the clocks, the state of the caches and the wallets, then shut the caches down
+             */
+            void persist();
+
+            /**
+             * Restore the state saved by persist, the file is removed so it is never restored twice
+             */
+            void loadState();
+
+            /**
+             * @returns: the directory where cachelib saves the allocator named name, empty if there is no persistence
+             */
+            std::string persistenceDirectory(const std::string& name) const;
+
+            /**
+             * Schedule the clocks of the caches without generator, the cleans and the market on the rounds of the generators
+             */
+            void configureRounds();
     };
 }
@@ -0,0 +1,164 @@
+#include "binary.hh"
+
+#include <cstring>
+
+using namespace cachecache;
+using namespace cachecache::binary_trace;
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================          WRITER         ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+BinaryTraceWriter::BinaryTraceWriter() {}
+
+BinaryTraceWriter::~BinaryTraceWriter() {
+    if (this->_file != nullptr) this->close();
+}
+
+bool BinaryTraceWriter::open(const std::string& path) {
+    this->_file = fopen(path.c_str(), "wb");
+    if (this->_file == nullptr) return false;
+
+    this->_blocks.clear();
+    this->_nb_records = 0;
+    this->_time = 0;
+
+    // the header is written once the index is known
+    Header header = {};
+    return fwrite(&header, sizeof(header), 1, this->_file) == 1;
+}
+
+bool BinaryTraceWriter::push(const line& l) {
+    if (!this->_blocks.empty() && l.timestamp < this->_time) return false;
+
+    uint32_t delta = this->_blocks.empty() ? 0 : l.timestamp - this->_time;
+    if (this->_blocks.empty() || delta != 0) {
+        this->_blocks.push_back(Block{l.timestamp, 0, this->_nb_records});
+    }
+
+    Record record = {};
+    record.hash = l.hash;
+    record.valuesize = l.valuesize;
+    record.ttl = l.TTL;
+    record.clientid = l.clientid;
+    record.keysize = l.key.size();
+    record.delta = delta < MAX_DELTA ? delta : MAX_DELTA;
+    record.operation = static_cast<uint8_t>(l.operation);
+
+    this->_time = l.timestamp;
+    this->_nb_records++;
+    return fwrite(&record, sizeof(record), 1, this->_file) == 1;
+}
+
+bool BinaryTraceWriter::close() {
+    if (this->_file == nullptr) return false;
+
+    Header header = {};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.record_size = sizeof(Record);
+    header.nb_records = this->_nb_records;
+    header.nb_blocks = this->_blocks.size();
+    header.index_offset = sizeof(Header) + this->_nb_records * sizeof(Record);
+
+    bool success = fwrite(this->_blocks.data(), sizeof(Block), this->_blocks.size(), this->_file) == this->_blocks.size();
+    success = success && fseek(this->_file, 0, SEEK_SET) == 0;
+    success = success && fwrite(&header, sizeof(header), 1, this->_file) == 1;
+    success = (fclose(this->_file) == 0) && success;
+
+    this->_file = nullptr;
+    return success;
+}
+
+/*
+ * ================================================================================
+ * ================================================================================
+ * =========================          READER         ==============================
+ * ================================================================================
+ * ================================================================================
+ */
+
+BinaryTraceReader::BinaryTraceReader() {}
+
+bool BinaryTraceReader::isBinary(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == nullptr) return false;
+
+    char magic[sizeof(MAGIC)];
+    bool res = fread(magic, sizeof(magic), 1, file) == 1 && memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+    fclose(file);
+    return res;
+}
+
+bool BinaryTraceReader::open(const std::string& path) {
+    this->close();
+    if (!this->_file.open(path)) return false;
+
+    if (this->_file.size() < sizeof(Header)) return false;
+
+    Header header;
+    memcpy(&header, this->_file.data(), sizeof(Header));
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION || header.record_size != sizeof(Record)) {
+        return false;
+    }
+
+    if (header.index_offset != sizeof(Header) + header.nb_records * sizeof(Record)
+        || header.index_offset + header.nb_blocks * sizeof(Block) > this->_file.size()) {
+        return false;
+    }
+
+    // the header and the records are 8 bytes aligned in the mapping
+    this->_records = reinterpret_cast<const Record*>(this->_file.data() + sizeof(Header));
+    this->_blocks = std::span<const Block>(reinterpret_cast<const Block*>(this->_file.data() + header.index_offset), header.nb_blocks);
+    this->_nb_records = header.nb_records;
+
+    return true;
+}
+
+void BinaryTraceReader::close() {
+    this->_file.close();
+    this->_records = nullptr;
+    this->_blocks = {};
+    this->_nb_records = 0;
+    this->_cursor = 0;
+    this->_block = 0;
+    this->_time = 0;
+}
+
+bool BinaryTraceReader::next(line& res) {
+    if (this->_cursor >= this->_nb_records) return false;
+
+    const Record& record = this->_records[this->_cursor];
+    if (record.delta == MAX_DELTA || this->_cursor == 0) {
+        while (this->_block + 1 < this->_blocks.size() && this->_blocks[this->_block + 1].first <= this->_cursor) {
+            this->_block++;
+        }
+        this->_time = this->_blocks[this->_block].timestamp;
+    } else {
+        this->_time += record.delta;
+    }
+
+    res.timestamp = this->_time;
+    res.hash = record.hash;
+    res.key = std::string_view();
+    res.keysize = sizeof(res.hash);
+    res.valuesize = record.valuesize;
+    res.clientid = record.clientid;
+    res.operation = static_cast<OPERATION>(record.operation);
+    res.TTL = record.ttl;
+
+    this->_cursor++;
+    return true;
+}
+
+std::span<const Block> BinaryTraceReader::getBlocks() const {
+    return this->_blocks;
+}
+
+uint64_t BinaryTraceReader::getIgnoredLines() const {
+    return 0;
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <service/traces/trace.hh>
+#include <service/traces/mapped.hh>
+
+namespace cachecache {
+    /**
+     * Binary traces, produced from the csv traces by cachecache_convert
+     * Layout: header | records | index
+     *    - the records have a fixed width, the keys are already hashed
+     *    - the timestamp of a record is the timestamp of the previous one + delta
+     *    - the index gives the first record of each second of the traces
+     */
+    namespace binary_trace {
+        const char MAGIC[8] = {'C', 'C', 'T', 'R', 'A', 'C', 'E', '\0'};
+        const uint32_t VERSION = 1;
+
+        // deltas are saturated, the exact timestamp is then given by the index
+        const uint8_t MAX_DELTA = UINT8_MAX;
+
+        struct __attribute__((packed)) Header {
+            char magic[8];
+            uint32_t version;
+            uint32_t record_size;
+            uint64_t nb_records;
+            uint64_t nb_blocks;
+            uint64_t index_offset;
+            uint8_t reserved[24];
+        };
+
+        struct __attribute__((packed)) Record {
+            uint64_t hash;
+            uint32_t valuesize;
+            int32_t ttl;
+            uint32_t clientid;
+            uint16_t keysize;
+            uint8_t delta;
+            uint8_t operation;
+        };
+
+        struct __attribute__((packed)) Block {
+            uint32_t timestamp;
+            uint32_t padding;
+            uint64_t first; // index of the first record of the second
+        };
+
+        static_assert(sizeof(Header) == 64);
+        static_assert(sizeof(Record) == 24);
+        static_assert(sizeof(Block) == 16);
+    }
+
+    /**
+     * Writes binary traces, the records must be pushed in timestamp order
+     */
+    class BinaryTraceWriter {
+        public:
+            BinaryTraceWriter();
+            ~BinaryTraceWriter();
+
+            BinaryTraceWriter(const BinaryTraceWriter&) = delete;
+            void operator=(const BinaryTraceWriter&) = delete;
+
+            /**
+             * @returns: false if the file could not be created
+             */
+            bool open(const std::string& path);
+
+            /**
+             * @returns: false if the line is older than the previous one
+             */
+            bool push(const line& l);
+
+            /**
+             * Write the index and the header, the traces are unreadable until then
+             * @returns: false on io error
+             */
+            bool close();
+
+        private:
+            FILE* _file = nullptr;
+            std::vector<binary_trace::Block> _blocks;
+            uint64_t _nb_records = 0;
+            uint32_t _time = 0;
+    };
+
+    /**
+     * Reads binary traces from a memory mapped file
+     */
+    class BinaryTraceReader {
+        public:
+            BinaryTraceReader();
+
+            BinaryTraceReader(const BinaryTraceReader&) = delete;
+            void operator=(const BinaryTraceReader&) = delete;
+
+            /**
+             * @returns: true if the file at path starts like binary traces
+             */
+            static bool isBinary(const std::string& path);
+
+            /**
+             * @returns: false if the file could not be mapped or is not valid binary traces
+             */
+            bool open(const std::string& path);
+            void close();
+
+            /**
+             * Read the next request, the key of the line is left empty (only the hash is stored)
+             * @returns: false at the end of the traces
+             */
+            bool next(line& res);
+
+            /**
+             * @returns: the index of the seconds of the traces
+             */
+            std::span<const binary_trace::Block> getBlocks() const;
+
+            uint64_t getIgnoredLines() const;
+
+        private:
+            MappedFile _file;
+            const binary_trace::Record* _records = nullptr;
+            std::span<const binary_trace::Block> _blocks;
+            uint64_t _nb_records = 0;
+
+            uint64_t _cursor = 0;
+            uint64_t _block = 0;
+            uint32_t _time = 0;
+    };
+}
@@ -0,0 +1,77 @@
+#include "mapped.hh"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace cachecache;
+
+MappedFile::MappedFile() {}
+
+MappedFile::~MappedFile() {
+    this->close();
+}
+
+MappedFile::MappedFile(MappedFile&& other):
+    _data(other._data)
+    , _size(other._size) {
+
+    other._data = nullptr;
+    other._size = 0;
+}
+
+void MappedFile::operator=(MappedFile&& other) {
+    this->close();
+    this->_data = other._data;
+    other._data = nullptr;
+    this->_size = other._size;
+    other._size = 0;
+}
+
+bool MappedFile::open(const std::string& path) {
+    this->close();
+
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        ::close(fd);
+        return false;
+    }
+
+    if (st.st_size != 0) {
+        void* memory = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (memory == MAP_FAILED) {
+            ::close(fd);
+            return false;
+        }
+
+        // the traces are read once from start to end
+        madvise(memory, st.st_size, MADV_SEQUENTIAL | MADV_WILLNEED);
+        this->_data = static_cast<const char*>(memory);
+        this->_size = st.st_size;
+    }
+
+    // the mapping stays valid once the file is closed
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close() {
+    if (this->_data != nullptr) {
+        munmap(const_cast<char*>(this->_data), this->_size);
+    }
+
+    this->_data = nullptr;
+    this->_size = 0;
+}
+
+const char* MappedFile::data() const {
+    return this->_data;
+}
+
+size_t MappedFile::size() const {
+    return this->_size;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace cachecache {
+    /**
+     * A read only memory mapping of a whole file
+     */
+    class MappedFile {
+        public:
+            MappedFile();
+            ~MappedFile();
+
+            MappedFile(const MappedFile&) = delete;
+            void operator=(const MappedFile&) = delete;
+
+            MappedFile(MappedFile&&);
+            void operator=(MappedFile&&);
+
+            /**
+             * @returns: false if the file could not be mapped
+             */
+            bool open(const std::string& path);
+            void close();
+
+            const char* data() const;
+            size_t size() const;
+
+        private:
+            const char* _data = nullptr;
+            size_t _size = 0;
+    };
+}
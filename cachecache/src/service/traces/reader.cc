@@ -0,0 +1,162 @@
+#include "reader.hh"
+
+#include <charconv>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace cachecache;
+
+TraceReader::TraceReader() {}
+
+TraceReader::~TraceReader() {
+    this->close();
+}
+
+TraceReader::TraceReader(TraceReader&& other):
+    _file(std::move(other._file))
+    , _end(other._end)
+    , _cursor(other._cursor)
+    , _hash(other._hash)
+    , _ignored_lines(other._ignored_lines) {
+
+    other._end = nullptr;
+    other._cursor = nullptr;
+    other._ignored_lines = 0;
+}
+
+void TraceReader::operator=(TraceReader&& other) {
+    this->_file = std::move(other._file);
+    this->_end = other._end;
+    other._end = nullptr;
+    this->_cursor = other._cursor;
+    other._cursor = nullptr;
+    this->_hash = other._hash;
+    this->_ignored_lines = other._ignored_lines;
+    other._ignored_lines = 0;
+}
+
+bool TraceReader::open(const std::string& path, bool hash) {
+    this->close();
+    this->_hash = hash;
+    this->_ignored_lines = 0;
+
+    if (!this->_file.open(path)) return false;
+
+    this->_cursor = this->_file.data();
+    this->_end = this->_file.data() + this->_file.size();
+    return true;
+}
+
+void TraceReader::close() {
+    this->_file.close();
+    this->_end = nullptr;
+    this->_cursor = nullptr;
+}
+
+bool TraceReader::next(line& res) {
+    while (this->_cursor < this->_end) {
+        const char* eol = endOfLine(this->_cursor, this->_end);
+        std::string_view l(this->_cursor, eol - this->_cursor);
+        this->_cursor = eol < this->_end ? eol + 1 : eol;
+
+        if (!l.empty() && l.back() == '\r') l.remove_suffix(1);
+        if (l.empty()) continue;
+
+        if (this->parse(l, res)) return true;
+        this->_ignored_lines++;
+    }
+
+    return false;
+}
+
+uint64_t TraceReader::getIgnoredLines() const {
+    return this->_ignored_lines;
+}
+
+bool TraceReader::parse(std::string_view l, line& res) const {
+    std::string_view fields[7];
+    const char* current = l.data();
+    const char* end = l.data() + l.size();
+
+    for (int i = 0; i < 7; i++) {
+        const char* next = delimiter(current, end);
+        fields[i] = std::string_view(current, next - current);
+        if (i < 6 && next == end) return false;
+        current = next + 1;
+    }
+
+    auto number = [](std::string_view field, auto& value) {
+        auto [ptr, ec] = std::from_chars(field.data(), field.data() + field.size(), value);
+        return ec == std::errc() && ptr == field.data() + field.size();
+    };
+
+    if (!number(fields[0], res.timestamp)) return false;
+
+    res.key = fields[1];
+    if (this->_hash) {
+        // same hash as std::hash<std::string>, the keys do not depend on the trace reader
+        res.hash = std::hash<std::string_view>{}(res.key);
+        res.keysize = sizeof(res.hash);
+    } else {
+        res.hash = 0;
+        res.keysize = res.key.size();
+    }
+
+    if (!number(fields[3], res.valuesize)) return false;
+    res.valuesize *= 2;
+
+    if (!number(fields[4], res.clientid)) return false;
+    if (!parseOperation(fields[5], res.operation)) return false;
+    if (!number(fields[6], res.TTL)) return false;
+
+    return true;
+}
+
+const char* TraceReader::delimiter(const char* from, const char* to) {
+#if defined(__SSE2__)
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    while (from + 16 <= to) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(from));
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, newline)));
+        if (mask != 0) return from + __builtin_ctz(mask);
+        from += 16;
+    }
+#endif
+
+    while (from < to && *from != ',' && *from != '\n') from++;
+    return from;
+}
+
+const char* TraceReader::endOfLine(const char* from, const char* to) {
+    const void* fnd = memchr(from, '\n', to - from);
+    return fnd != nullptr ? static_cast<const char*>(fnd) : to;
+}
+
+bool TraceReader::parseOperation(std::string_view op, OPERATION& res) {
+    static constexpr std::pair<std::string_view, OPERATION> OPERATIONS[] = {
+        {"get", OPERATION::GET}
+        , {"set", OPERATION::SET}
+        , {"gets", OPERATION::GETS}
+        , {"add", OPERATION::ADD}
+        , {"replace", OPERATION::REPLACE}
+        , {"cas", OPERATION::CAS}
+        , {"append", OPERATION::APPEND}
+        , {"prepend", OPERATION::PREPEND}
+        , {"delete", OPERATION::DELETE}
+        , {"incr", OPERATION::INCR}
+        , {"decr", OPERATION::DECR}
+    };
+
+    for (auto & [name, operation]: OPERATIONS) {
+        if (name == op) {
+            res = operation;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include <service/traces/trace.hh>
+#include <service/traces/mapped.hh>
+
+namespace cachecache {
+    /**
+     * Reads csv traces (timestamp,key,keysize,valuesize,clientid,operation,ttl) from a memory mapped file
+     * The lines are parsed in place, without any allocation
+     */
+    class TraceReader {
+        public:
+            TraceReader();
+            ~TraceReader();
+
+            TraceReader(const TraceReader&) = delete;
+            void operator=(const TraceReader&) = delete;
+
+            TraceReader(TraceReader&&);
+            void operator=(TraceReader&&);
+
+            /**
+             * @params:
+             *    - path: the csv file to read
+             *    - hash: compute the 64 bits hash of the keys (left to 0 otherwise)
+             * @returns: false if the file could not be mapped
+             */
+            bool open(const std::string& path, bool hash);
+            void close();
+
+            /**
+             * Parse the next request of the traces, the malformed lines are skipped
+             * @returns: false at the end of the file
+             */
+            bool next(line& res);
+
+            /**
+             * @returns: the number of malformed lines skipped so far
+             */
+            uint64_t getIgnoredLines() const;
+
+        private:
+            MappedFile _file;
+            const char* _end = nullptr;
+            const char* _cursor = nullptr;
+
+            bool _hash = false;
+            uint64_t _ignored_lines = 0;
+
+            bool parse(std::string_view l, line& res) const;
+
+            /**
+             * @returns: the position of the first ',' or '\n' in [from, to[, to if there is none
+             */
+            static const char* delimiter(const char* from, const char* to);
+            static const char* endOfLine(const char* from, const char* to);
+            static bool parseOperation(std::string_view op, OPERATION& res);
+    };
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace cachecache {
+    // will manage first get, gets, set, add, replace, append, delete
+    enum class OPERATION : uint8_t {
+        GET
+        ,GETS // get with CAS, not implemented in redis
+        ,SET
+        ,ADD // set only if key does not exists, SET with NX option in redis
+        ,REPLACE // set + XX option in redis
+        ,CAS // compare and swap, not implemented in redis
+        ,APPEND
+        ,PREPEND
+        ,DELETE
+        ,INCR
+        ,DECR
+    };
+
+    const size_t NB_OPERATIONS = static_cast<size_t>(OPERATION::DECR) + 1;
+
+    const std::unordered_map<std::string, OPERATION> STR_TO_OPERATION = {
+        {"get", OPERATION::GET}
+        , {"gets", OPERATION::GETS}
+        , {"set", OPERATION::SET}
+        , {"add", OPERATION::ADD}
+        , {"replace", OPERATION::REPLACE}
+        , {"cas", OPERATION::CAS}
+        , {"append", OPERATION::APPEND}
+        , {"prepend", OPERATION::PREPEND}
+        , {"delete", OPERATION::DELETE}
+        , {"incr", OPERATION::INCR}
+        , {"decr", OPERATION::DECR}
+    };
+
+    /**
+     * A request of the traces
+     * The key is a view on the trace file, it is only valid while the reader that produced the line is alive
+     */
+    struct line {
+        uint32_t timestamp;
+        uint64_t hash;
+        std::string_view key;
+        int keysize;
+        int valuesize;
+        int clientid;
+        OPERATION operation;
+        int TTL;
+    };
+}
@@ -230,18 +230,24 @@ def plot_eviction_target(input_file, output_file):
     plt.legend()
     plt.savefig(output_file)
 
-def plot_delta(input_file, output_file):
-    data = parse_csv_list(input_file)
-    
+def plot_delta(input_counts, input_sums, output_file):
+    # delta.csv holds the number of hits per power of two bucket of delta, delta_sum.csv the sum of their deltas
+    counts = parse_csv_list(input_counts)
+    sums = parse_csv(input_sums)
+
     plt.clf()
-    for client, rows in data.items():
-        time = list(rows.keys())
+    for client, rows in sums.items():
+        time = []
         deltas = []
 
-        for t in time:
-            d = list(map(lambda x: int(x), rows[t]['delta']))
-            d = sum(d) / len(d)
-            deltas.append(d)
+        for t in rows.keys():
+            if t not in counts.get(client, {}):
+                continue
+            nb = sum(map(lambda x: float(x), counts[client][t]['delta']))
+            if nb == 0:
+                continue
+            time.append(t)
+            deltas.append(float(rows[t]['delta_sum']) / nb)
         plt.plot(time, deltas, label=client)
     plt.title("Time between two calls")
     plt.legend()
@@ -258,7 +264,7 @@ def analyze(input_directory, output_directory):
     plot_size_evictions(f"{input_directory}/size_eviction.csv", f"{output_directory}/size_eviction.png")
     plot_eviction_target(f"{input_directory}/eviction_target.csv", f"{output_directory}/eviction_target.png")
     plot_percentiles(f"{input_directory}/percentile.csv", f"{output_directory}/percentiles.png")
-    plot_delta(f"{input_directory}/delta.csv", f"{output_directory}/deltas.png")
+    plot_delta(f"{input_directory}/delta.csv", f"{input_directory}/delta_sum.csv", f"{output_directory}/deltas.png")
 
 
 if __name__ == "__main__":